@@ -1,15 +1,23 @@
 struct buf;
 struct context;
+struct cpage;
 struct file;
 struct inode;
+struct meminfo;
+struct schedinfo;
 struct pipe;
 struct proc;
 struct rtcdate;
 struct spinlock;
+struct lockstat;
+struct lockclass;
 struct sleeplock;
 struct stat;
+struct timer;
 struct superblock;
 struct page;
+struct ptwalk;
+struct tlbbatch;
 
 // bio.c
 void            binit(void);
@@ -35,6 +43,12 @@ int             fileread(struct file*, char*, int n);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
 
+// futex.c
+void            futexevict(uint);
+void            futexinit(void);
+int             futexwait(uint, uint);
+int             futexwake(uint, int);
+
 // fs.c
 void            readsb(int dev, struct superblock *sb);
 int             dirlink(struct inode*, char*, uint);
@@ -43,6 +57,7 @@ struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit(int dev);
 void            ilock(struct inode*);
+void            ilock_shared(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
@@ -73,6 +88,9 @@ void            ioapicinit(void);
 // kalloc.c
 char*           kalloc(void);
 void            kfree(char*);
+void            kref(char*);
+int             kfreecount(void);
+void            kmeminfo(struct meminfo*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
 
@@ -85,7 +103,10 @@ int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
+void            lapicipi(int, int);
 void            lapicstartap(uchar, uint);
+uint            lapicticking(void);
+void            lapictickless(uint);
 void            microdelay(int);
 
 // log.c
@@ -94,10 +115,26 @@ void            log_write(struct buf*);
 void            begin_op();
 void            end_op();
 
+// mmap.c
+int             mmap(struct file*, uint, uint, int, int);
+int             munmap(uint, uint);
+int             mmapfault(struct proc*, uint, uint);
+int             mmapfork(struct proc*, struct proc*);
+void            mmapexit(void);
+
 // mp.c
 extern int      ismp;
 void            mpinit(void);
 
+// pcache.c
+void            pcacheinit(void);
+struct cpage*   pcfind(struct inode*, uint);
+struct cpage*   pcget(struct inode*, uint);
+void            pcrelse(struct cpage*);
+void            pcacheinval(struct inode*);
+int             pcachereclaim(int);
+int             pcachecount(void);
+
 // picirq.c
 void            picenable(int);
 void            picinit(void);
@@ -111,6 +148,8 @@ int             pipewrite(struct pipe*, char*, int);
 //PAGEBREAK: 16
 // proc.c
 int             cpuid(void);
+void            cpucount(int, uint);
+uint            cpucounts(int);
 void            exit(void);
 int             fork(void);
 int             growproc(int);
@@ -119,6 +158,8 @@ struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
 void            procdump(void);
+void            procmeminfo(struct meminfo*);
+void            procschedinfo(struct schedinfo*);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            setproc(struct proc*);
@@ -127,9 +168,30 @@ void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
 void            yield(void);
+int             proctick(void);
+void            mlfqboost(void);
+int             getlevel(int);
+int             settickets(int);
+int             settimeslice(int);
+int             setaffinity(int, uint);
+int             clone(void(*)(void*), void*, void*);
+int             join(void**);
+void            lockvm(struct proc*);
+int             trylockvm(struct proc*);
+void            unlockvm(struct proc*);
 int		swapIn(struct page * pg);
 int		swapOut(struct page * pg);
+void            pagedrop(struct proc*, uint, uint);
+
 
+// shm.c
+void            shminit(void);
+int             shmget(int, uint);
+int             shmat(int);
+int             shmdt(uint);
+int             shmfork(struct proc*, struct proc*);
+void            shmexit(void);
+void            shmexec(struct proc*);
 
 // swtch.S
 void            swtch(struct context**, struct context*);
@@ -139,14 +201,21 @@ void            acquire(struct spinlock*);
 void            getcallerpcs(void*, uint*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            initmcslock(struct spinlock*, char*);
+struct lockclass* lockclass(char*, int);
+uint64          lockacquired(struct lockclass*, int, uint64);
+void            lockreleased(struct lockclass*, uint64);
+void            getlockstat(struct lockstat*, int);
 void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
+void            acquiresleep_shared(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
+int             holdingsleep_shared(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
 // string.c
@@ -168,6 +237,10 @@ void            syscall(void);
 
 // timer.c
 void            timerinit(void);
+void            timeradd(struct timer*);
+void            timerdel(struct timer*);
+void            timertick(void);
+uint            timernext(void);
 
 // trap.c
 void            idtinit(void);
@@ -197,6 +270,13 @@ int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
 pde_t*		walkpgdir(pde_t *pgdir, const void *va, int alloc);
 int		mappages(pde_t *pgdir, void *va, uint, uint, int); 
+void            ptwalkinit(struct ptwalk*, pde_t*, uint, uint);
+int             ptwalknext(struct ptwalk*);
+void            tlbinval(struct tlbbatch*, uint);
+void            tlbflush(struct tlbbatch*);
+void            tlbshootintr(void);
+int             residentpages(pde_t*);
+void            vmmeminfo(struct meminfo*);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -19,6 +19,10 @@ exec(char *path, char **argv)
   pde_t *pgdir, *oldpgdir;
   struct proc *curproc = myproc();
 
+  // Other threads would be left running in the old image.
+  if(curproc->nthread > 1 || curproc->leader != curproc)
+    return -1;
+
   begin_op();
 
   if((ip = namei(path)) == 0){
@@ -26,7 +30,7 @@ exec(char *path, char **argv)
     cprintf("exec: fail\n");
     return -1;
   }
-  ilock(ip);
+  ilock_shared(ip);
   pgdir = 0;
 
   // Check ELF header
@@ -94,13 +98,16 @@ exec(char *path, char **argv)
   safestrcpy(curproc->name, last, sizeof(curproc->name));
 
   // Commit to the user image.
+  mmapexit();
   oldpgdir = curproc->pgdir;
   curproc->pgdir = pgdir;
   curproc->sz = sz;
   curproc->tf->eip = elf.entry;  // main
   curproc->tf->esp = sp;
   switchuvm(curproc);
+  pagedrop(curproc, 0, KERNBASE);  // No threads, so no lockvm.
   freevm(oldpgdir);
+  shmexec(curproc);
   return 0;
 
  bad:
@@ -103,7 +103,12 @@ fileread(struct file *f, char *addr, int n)
   if(f->type == FD_PIPE)
     return piperead(f->pipe, addr, n);
   if(f->type == FD_INODE){
-    ilock(f->ip);
+    // Readers can share the inode unless another descriptor
+    // shares f, and with it the offset the lock also guards.
+    if(f->ref == 1)
+      ilock_shared(f->ip);
+    else
+      ilock(f->ip);
     if((r = readi(f->ip, addr, f->off, n)) > 0)
       f->off += r;
     iunlock(f->ip);
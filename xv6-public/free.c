@@ -0,0 +1,36 @@
+// Print system memory use and each process's resident
+// and swapped pages.  Sizes are in kilobytes.
+
+#include "types.h"
+#include "stat.h"
+#include "param.h"
+#include "meminfo.h"
+#include "user.h"
+
+#define KB(pages) ((pages) * 4)
+
+struct meminfo mi;
+
+int
+main(int argc, char *argv[])
+{
+  struct procmem *pm;
+
+  if(meminfo(&mi) < 0){
+    printf(2, "free: meminfo failed\n");
+    exit();
+  }
+
+  printf(1, "\ttotal\tused\tfree\tcached\n");
+  printf(1, "Mem:\t%d\t%d\t%d\t%d\n", KB(mi.total),
+         KB(mi.total - mi.free), KB(mi.free), KB(mi.cached));
+  printf(1, "Swap:\t%d\n", KB(mi.swapped));
+  printf(1, "allocs %d frees %d swapins %d swapouts %d\n",
+         mi.allocs, mi.frees, mi.swapins, mi.swapouts);
+
+  printf(1, "\nPID\tSIZE\tRSS\tSWAP\tNAME\n");
+  for(pm = mi.proc; pm < &mi.proc[mi.nproc]; pm++)
+    printf(1, "%d\t%d\t%d\t%d\t%s\n", pm->pid, pm->sz / 1024,
+           KB(pm->rss), KB(pm->swapped), pm->name);
+  exit();
+}
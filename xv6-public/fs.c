@@ -19,6 +19,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "pcache.h"
 #include "file.h"
 #include "fcntl.h"
 
@@ -314,11 +315,29 @@ ilock(struct inode *ip)
   }
 }
 
-// Unlock the given inode.
+// Lock the given inode for reading, shared with other readers
+// but not with a writer.  The caller may examine ip and read its
+// content (readi, dirlookup) but must not change either.
+void
+ilock_shared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilock_shared");
+
+  acquiresleep_shared(&ip->lock);
+  if(ip->valid == 0){
+    // Reading it from disk needs the inode to ourselves.
+    releasesleep(&ip->lock);
+    ilock(ip);
+  }
+}
+
+// Unlock the given inode, locked by ilock() or ilock_shared().
 void
 iunlock(struct inode *ip)
 {
-  if(ip == 0 || !holdingsleep(&ip->lock) || ip->ref < 1)
+  if(ip == 0 || ip->ref < 1 ||
+     !(holdingsleep(&ip->lock) || holdingsleep_shared(&ip->lock)))
     panic("iunlock");
 
   releasesleep(&ip->lock);
@@ -414,6 +433,7 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  pcacheinval(ip);
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -449,14 +469,30 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Copy n bytes at off from ip's data blocks to dst
+// through the block cache.
+static void
+readblocks(struct inode *ip, char *dst, uint off, uint n)
+{
+  uint tot, m;
+  struct buf *bp;
+
+  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    m = min(n - tot, BSIZE - off%BSIZE);
+    memmove(dst, bp->data + off%BSIZE, m);
+    brelse(bp);
+  }
+}
+
 //PAGEBREAK!
-// Read data from inode.
+// Read data from inode, through the page cache.
 // Caller must hold ip->lock.
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
-  uint tot, m;
-  struct buf *bp;
+  uint tot, m, start;
+  struct cpage *c;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read)
@@ -470,22 +506,34 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    memmove(dst, bp->data + off%BSIZE, m);
-    brelse(bp);
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    if((c = pcget(ip, off/PGSIZE)) == 0){
+      // No room in the page cache.
+      readblocks(ip, dst, off, m);
+      continue;
+    }
+    if(!c->valid){
+      start = off - off%PGSIZE;
+      memset(c->data, 0, PGSIZE);
+      readblocks(ip, c->data, start, min(ip->size - start, PGSIZE));
+      c->valid = 1;
+    }
+    memmove(dst, c->data + off%PGSIZE, m);
+    pcrelse(c);
   }
   return n;
 }
 
 // PAGEBREAK!
-// Write data to inode.
+// Write data to inode.  The blocks go through the log;
+// any cached copy of the page is updated too.
 // Caller must hold ip->lock.
 int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  struct cpage *c;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].write)
@@ -504,6 +552,11 @@ writei(struct inode *ip, char *src, uint off, uint n)
     memmove(bp->data + off%BSIZE, src, m);
     log_write(bp);
     brelse(bp);
+    if((c = pcfind(ip, off/PGSIZE)) != 0){
+      if(c->valid)
+        memmove(c->data + off%PGSIZE, src, m);
+      pcrelse(c);
+    }
   }
 
   if(n > 0 && off > ip->size){
@@ -635,7 +688,7 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
+    ilock_shared(ip);
     if(ip->type != T_DIR){
       iunlockput(ip);
       return 0;
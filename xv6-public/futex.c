@@ -0,0 +1,173 @@
+// Futexes: sleeping on a word of user memory.
+//
+// futexwait(addr, val) sleeps only if the word at addr still
+// holds val, and futexwake(addr, n) wakes up to n sleepers on
+// addr.  User-space locks built on them (see uthread.c) use
+// atomic instructions on the word and enter the kernel only
+// when they must wait or have waiters to wake.
+//
+// A sleeper is keyed by the physical address of its word, so
+// threads sharing an address space and processes sharing a
+// shm segment meet at the same key.  Sleepers are hashed by
+// that address, and each bucket's lock guards its list.
+//
+// A page that is swapped out comes back at a different
+// physical address, so swapOut() wakes everyone sleeping on
+// the page (futexevict).  Futex callers must expect early
+// wakeups anyway and recheck the word.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+
+#define NFUTEXQ 31
+#define FUTEXQ(pa) (&futexqs[(pa) / 4 % NFUTEXQ])
+
+// A sleeper, on its own kernel stack.
+struct futexwaiter {
+  uint pa;                     // Physical address of the word
+  int woken;
+  struct futexwaiter *next;
+};
+
+struct futexq {
+  struct spinlock lock;
+  struct futexwaiter *head;
+} futexqs[NFUTEXQ];
+
+void
+futexinit(void)
+{
+  int i;
+
+  for(i = 0; i < NFUTEXQ; i++)
+    initlock(&futexqs[i].lock, "futex");
+}
+
+// Return the physical address of the user word at addr, with
+// the caller's address space locked (lockvm) so the page cannot
+// be swapped out.  Returns 0 if addr is not a mapped word.
+// Heap pages are faulted in first.
+static uint
+futexpa(uint addr)
+{
+  struct proc *curproc = myproc();
+  pte_t *pte;
+  int x;
+
+  if(addr % 4 != 0 || addr >= KERNBASE)
+    return 0;
+  for(;;){
+    if(addr < curproc->sz && fetchint(addr, &x) < 0)
+      return 0;
+    lockvm(curproc);
+    pte = walkpgdir(curproc->pgdir, (char*)addr, 0);
+    if(pte && (*pte & (PTE_P|PTE_U)) == (PTE_P|PTE_U))
+      return PTE_ADDR(*pte) | (addr & (PGSIZE-1));
+    unlockvm(curproc);
+    // Beyond the heap, only pages already mapped will do.
+    if(addr >= curproc->sz)
+      return 0;
+    // Swapped out again before we locked; fault it back in.
+  }
+}
+
+// Sleep until woken by futexwake(addr) if the word at addr
+// holds val.  Returns 0 once woken, or -1 if the word held
+// something else, addr is bad, or the process was killed.
+int
+futexwait(uint addr, uint val)
+{
+  struct proc *curproc = myproc();
+  struct futexwaiter w, **pp;
+  struct futexq *q;
+  uint pa;
+
+  if((pa = futexpa(addr)) == 0)
+    return -1;
+  q = FUTEXQ(pa);
+  acquire(&q->lock);
+  if(*(uint*)P2V(pa) != val){
+    release(&q->lock);
+    unlockvm(curproc);
+    return -1;
+  }
+  w.pa = pa;
+  w.woken = 0;
+  w.next = 0;
+  for(pp = &q->head; *pp; pp = &(*pp)->next)
+    ;
+  *pp = &w;
+  release(&q->lock);
+  unlockvm(curproc);
+
+  // A wakeup in between sets w.woken, so none is lost.
+  acquire(&q->lock);
+  while(!w.woken && !curproc->killed)
+    sleep(&w, &q->lock);
+  if(!w.woken){
+    for(pp = &q->head; *pp != &w; pp = &(*pp)->next)
+      ;
+    *pp = w.next;
+  }
+  release(&q->lock);
+  return w.woken ? 0 : -1;
+}
+
+// Wake up to n sleepers on the word at addr, oldest first.
+// Returns the number woken, or -1 if addr is bad.
+int
+futexwake(uint addr, int n)
+{
+  struct proc *curproc = myproc();
+  struct futexwaiter *w, **pp;
+  struct futexq *q;
+  uint pa;
+  int woken;
+
+  if((pa = futexpa(addr)) == 0)
+    return -1;
+  q = FUTEXQ(pa);
+  woken = 0;
+  acquire(&q->lock);
+  for(pp = &q->head; (w = *pp) != 0 && woken < n; ){
+    if(w->pa != pa){
+      pp = &w->next;
+      continue;
+    }
+    *pp = w->next;
+    w->woken = 1;
+    wakeup(w);
+    woken++;
+  }
+  release(&q->lock);
+  unlockvm(curproc);
+  return woken;
+}
+
+// The page at physical address pa is leaving memory; wake
+// everyone sleeping on a word in it.
+void
+futexevict(uint pa)
+{
+  struct futexwaiter *w, **pp;
+  struct futexq *q;
+
+  for(q = futexqs; q < &futexqs[NFUTEXQ]; q++){
+    acquire(&q->lock);
+    for(pp = &q->head; (w = *pp) != 0; ){
+      if(PGROUNDDOWN(w->pa) != pa){
+        pp = &w->next;
+        continue;
+      }
+      *pp = w->next;
+      w->woken = 1;
+      wakeup(w);
+    }
+    release(&q->lock);
+  }
+}
@@ -41,6 +41,14 @@
 #define TCCR    (0x0390/4)   // Timer Current Count
 #define TDCR    (0x03E0/4)   // Timer Divide Configuration
 
+// PIT channel 2, used to calibrate the timer.
+#define PITHZ     1193182    // PIT input clock
+#define PIT2      0x42       // Channel 2 count
+#define PITMODE   0x43
+#define PITGATE   0x61       // Channel 2 gate (bit 0) and output (bit 5)
+
+static uint tickcount;       // Timer counts per clock tick
+
 volatile uint *lapic;  // Initialized in mp.c
 
 //PAGEBREAK!
@@ -51,6 +59,27 @@ lapicw(int index, int value)
   lapic[ID];  // wait for write to finish, by reading
 }
 
+// Return the timer's counts per second, measured over
+// 10ms of PIT channel 2, or 0 if the PIT did not count.
+static uint
+lapiccalibrate(void)
+{
+  uint n, i;
+
+  n = PITHZ / 100;
+  outb(PITGATE, (inb(PITGATE) & ~0x02) | 0x01);  // gate on, speaker off
+  outb(PITMODE, 0xB0);  // channel 2, lo/hi byte, count down once
+  lapicw(TDCR, X1);
+  lapicw(TIMER, MASKED | (T_IRQ0 + IRQ_TIMER));
+  lapicw(TICR, 0xFFFFFFFF);
+  outb(PIT2, n & 0xFF);
+  outb(PIT2, n >> 8);
+  for(i = 0; (inb(PITGATE) & 0x20) == 0; i++)
+    if(i == 100000000)
+      return 0;
+  return (0xFFFFFFFF - lapic[TCCR]) * 100;
+}
+
 void
 lapicinit(void)
 {
@@ -62,11 +91,13 @@ lapicinit(void)
 
   // The timer repeatedly counts down at bus frequency
   // from lapic[TICR] and then issues an interrupt.
-  // If xv6 cared more about precise timekeeping,
-  // TICR would be calibrated using an external time source.
+  // The boot CPU measures the bus frequency, and all CPUs
+  // set TICR for HZ interrupts a second.
+  if(tickcount == 0 && (tickcount = lapiccalibrate() / HZ) == 0)
+    tickcount = 10000000;
   lapicw(TDCR, X1);
   lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
-  lapicw(TICR, 10000000);
+  lapicw(TICR, tickcount);
 
   // Disable logical interrupt lines.
   lapicw(LINT0, MASKED);
@@ -113,6 +144,52 @@ lapiceoi(void)
     lapicw(EOI, 0);
 }
 
+// Send interrupt vector to the CPU with the given APIC ID.
+void
+lapicipi(int apicid, int vector)
+{
+  lapicw(ICRHI, apicid<<24);
+  lapicw(ICRLO, FIXED | ASSERT | vector);
+  while(lapic[ICRLO] & DELIVS)
+    ;
+}
+
+// Stop the periodic tick while this CPU idles.  If n > 0,
+// interrupt once after n ticks; if n is 0, not at all.
+// lapicticking() restarts the periodic tick.
+void
+lapictickless(uint n)
+{
+  if(!lapic)
+    return;
+  if(n == 0){
+    lapicw(TIMER, MASKED | (T_IRQ0 + IRQ_TIMER));
+    return;
+  }
+  if(n > 0xFFFFFFFF / tickcount)
+    n = 0xFFFFFFFF / tickcount;
+  lapicw(TIMER, T_IRQ0 + IRQ_TIMER);  // one-shot
+  lapicw(TICR, n * tickcount);
+}
+
+// Restart the periodic tick after lapictickless().
+// Returns the number of whole ticks that went by.
+uint
+lapicticking(void)
+{
+  uint init, left;
+
+  if(!lapic)
+    return 0;
+  init = lapic[TICR];
+  left = lapic[TCCR];
+  if(lapic[TIMER] & MASKED)
+    init = left = 0;
+  lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
+  lapicw(TICR, tickcount);
+  return (init - left) / tickcount;
+}
+
 // Spin for a given number of microseconds.
 // On real hardware would want to tune this dynamically.
 void
@@ -0,0 +1,43 @@
+// Print lock contention counters, most waited-for locks first.
+// Times are in units of 1024 TSC cycles.
+// With -r, also reset the counters.
+
+#include "types.h"
+#include "stat.h"
+#include "param.h"
+#include "lockstat.h"
+#include "user.h"
+
+struct lockstat ls;
+
+int
+main(int argc, char *argv[])
+{
+  struct lockinfo *li, t;
+  int i, j, reset;
+
+  reset = argc > 1 && strcmp(argv[1], "-r") == 0;
+  if(argc > 2 || (argc == 2 && !reset)){
+    printf(2, "usage: lockstat [-r]\n");
+    exit();
+  }
+  if(lockstat(&ls, reset) < 0){
+    printf(2, "lockstat: lockstat failed\n");
+    exit();
+  }
+
+  // Insertion sort by wait time, longest first.
+  for(i = 1; i < ls.n; i++){
+    t = ls.lock[i];
+    for(j = i; j > 0 && ls.lock[j-1].wait < t.wait; j--)
+      ls.lock[j] = ls.lock[j-1];
+    ls.lock[j] = t;
+  }
+
+  printf(1, "NAME\t\tTYPE\tACQ\tCONT\tWAIT\tHOLD\n");
+  for(li = ls.lock; li < &ls.lock[ls.n]; li++)
+    printf(1, "%s\t%s%s\t%d\t%d\t%d\t%d\n", li->name,
+           strlen(li->name) < 8 ? "\t" : "", li->sleep ? "sleep" : "spin",
+           li->nacquire, li->ncontended, li->wait, li->hold);
+  exit();
+}
@@ -0,0 +1,17 @@
+// Lock contention reported by the lockstat system call.
+// Locks with the same name are counted together as one class.
+// Times are in units of 1024 TSC cycles.  Include param.h first.
+
+struct lockinfo {
+  char name[16];
+  int sleep;         // 1 for sleeplocks, 0 for spinlocks
+  uint nacquire;     // Acquisitions
+  uint ncontended;   // Acquisitions that had to wait
+  uint wait;         // Time spent waiting: spinning or asleep
+  uint hold;         // Time held
+};
+
+struct lockstat {
+  int n;             // Entries used in lock[]
+  struct lockinfo lock[NLOCKCLASS];
+};
@@ -29,7 +29,10 @@ main(void)
   pinit();         // process table
   tvinit();        // trap vectors
   binit();         // buffer cache
+  pcacheinit();    // file page cache
   fileinit();      // file table
+  shminit();       // shared memory segments
+  futexinit();     // futex wait queues
   ideinit();       // disk 
   startothers();   // start other processors
   //cprintf("[][][]about to kinit[][][]");
@@ -44,7 +47,7 @@ main(void)
 static void
 mpenter(void)
 {
-  switchkvm();
+  lcr3(V2P(kpgdir));  // no switchkvm() before seginit()
   seginit();
   lapicinit();
   mpmain();
@@ -0,0 +1,23 @@
+// Memory usage reported by the meminfo system call.
+// Sizes are in pages unless noted.  Include param.h first.
+
+struct procmem {
+  int pid;
+  uint sz;           // Size of process memory (bytes)
+  int rss;           // Pages resident in memory
+  int swapped;       // Pages in the swap file
+  char name[16];
+};
+
+struct meminfo {
+  int total;         // Physical pages managed by kalloc
+  int free;          // Free physical pages
+  int cached;        // Pages held by the file page cache
+  int swapped;       // Pages in all swap files
+  uint allocs;       // User pages allocated since boot
+  uint frees;        // User pages freed by deallocuvm and freevm
+  uint swapins;      // Pages read back from swap files
+  uint swapouts;     // Pages written to swap files
+  int nproc;         // Entries used in proc[]
+  struct procmem proc[NPROC];
+};
@@ -5,6 +5,8 @@
 #define DEVSPACE 0xFE000000         // Other devices are at high addresses
 
 // Key addresses for address space layout (see kmap in vm.c for layout)
+#define MMAPBASE 0x40000000         // Memory-mapped files (see mmap.c)
+#define SHMBASE  0x7F000000         // Shared memory segments (see shm.c)
 #define KERNBASE 0x80000000         // First kernel virtual address
 #define KERNLINK (KERNBASE+EXTMEM)  // Address where kernel is linked
 
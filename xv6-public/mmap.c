@@ -0,0 +1,339 @@
+// Memory-mapped files.
+//
+// Each process has a small table of mapped regions (p->vmas),
+// placed between MMAPBASE and SHMBASE.  Nothing is read when a
+// region is created: mmapfault() fills each page from the inode
+// the first time it is touched.
+//
+// MAP_SHARED pages that the hardware has marked dirty (PTE_D)
+// are written back to the file by munmap(), exec() and exit().
+// MAP_PRIVATE pages are never written back.  fork() gives the
+// child the parent's frames: shared regions stay writable in
+// both, private ones become read-only PTE_COW in both and are
+// copied on the first write.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "stat.h"
+
+// Write the dirty pages of shared region v back to its file.
+static void
+mmapwriteback(struct proc *p, struct vma *v)
+{
+  // Like filewrite, stay within the log's transaction size.
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  struct inode *ip;
+  pte_t *pte;
+  uint a, off, n, i, n1;
+
+  if(!(v->flags & MAP_SHARED) || !(v->prot & PROT_WRITE))
+    return;
+  ip = v->f->ip;
+  for(a = v->start; a < v->end; a += PGSIZE){
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if(pte == 0 || (*pte & (PTE_P|PTE_D)) != (PTE_P|PTE_D))
+      continue;
+    off = v->off + (a - v->start);
+    // Never grow the file; bytes past its end are dropped.
+    ilock_shared(ip);
+    n = off < ip->size ? ip->size - off : 0;
+    iunlock(ip);
+    if(n > PGSIZE)
+      n = PGSIZE;
+    for(i = 0; i < n; i += n1){
+      n1 = n - i;
+      if(n1 > max)
+        n1 = max;
+      begin_op();
+      ilock(ip);
+      writei(ip, (char*)P2V(PTE_ADDR(*pte)) + i, off + i, n1);
+      iunlock(ip);
+      end_op();
+    }
+    *pte &= ~PTE_D;
+  }
+}
+
+// Remove [start, end) of region v from p, writing back
+// shared pages first.  start and end must be page-aligned
+// and lie within v.
+static void
+mmapunmap(struct proc *p, struct vma *v, uint start, uint end)
+{
+  struct tlbbatch tb;
+  struct vma part;
+  char *pages[NTLBBATCH];
+  pte_t *pte;
+  uint a;
+  int i;
+
+  part = *v;
+  part.start = start;
+  part.end = end;
+  part.off = v->off + (start - v->start);
+  mmapwriteback(p, &part);
+
+  // Free each frame only after its mapping is gone from
+  // every TLB.
+  tb.pgdir = p->pgdir;
+  tb.n = 0;
+  for(a = start; a < end; a += PGSIZE){
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if(pte == 0 || (*pte & PTE_P) == 0)
+      continue;
+    pages[tb.n] = P2V(PTE_ADDR(*pte));
+    *pte = 0;
+    tlbinval(&tb, a);
+    if(tb.n == NTLBBATCH){
+      tlbflush(&tb);
+      for(i = 0; i < NTLBBATCH; i++)
+        kfree(pages[i]);
+    }
+  }
+  i = tb.n;
+  tlbflush(&tb);
+  while(--i >= 0)
+    kfree(pages[i]);
+
+  if(start == v->start && end == v->end){
+    fileclose(v->f);
+    v->f = 0;
+  } else if(start == v->start){
+    v->off += end - v->start;
+    v->start = end;
+  } else
+    v->end = start;
+}
+
+// Map len bytes of file f starting at offset off into the
+// current process.  Returns the address of the mapping, or -1.
+int
+mmap(struct file *f, uint off, uint len, int prot, int flags)
+{
+  struct proc *curproc = myproc()->leader;
+  struct vma *v, *fv;
+  uint start;
+
+  if(len == 0 || off % PGSIZE != 0)
+    return -1;
+  if((flags & (MAP_SHARED|MAP_PRIVATE)) == 0 ||
+     (flags & (MAP_SHARED|MAP_PRIVATE)) == (MAP_SHARED|MAP_PRIVATE))
+    return -1;
+  if(f->type != FD_INODE || f->ip->type != T_FILE || !f->readable)
+    return -1;
+  if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+    return -1;
+  len = PGROUNDUP(len);
+
+  // First fit: slide start past every region it overlaps.
+  start = MMAPBASE;
+  fv = 0;
+  for(v = curproc->vmas; v < &curproc->vmas[NVMA]; v++){
+    if(v->f == 0){
+      if(fv == 0)
+        fv = v;
+      continue;
+    }
+    if(start < v->end && v->start < start + len){
+      start = v->end;
+      v = curproc->vmas - 1;
+    }
+  }
+  if(fv == 0 || start + len > SHMBASE || start + len < start)
+    return -1;
+
+  fv->start = start;
+  fv->end = start + len;
+  fv->off = off;
+  fv->prot = prot;
+  fv->flags = flags;
+  fv->f = filedup(f);
+  return start;
+}
+
+// Unmap [addr, addr+len) from the current process.  The range
+// must start or end at a boundary of a single mapped region.
+int
+munmap(uint addr, uint len)
+{
+  struct proc *curproc = myproc()->leader;
+  struct vma *v;
+  uint end;
+
+  if(addr % PGSIZE != 0 || len == 0)
+    return -1;
+  end = PGROUNDUP(addr + len);
+  for(v = curproc->vmas; v < &curproc->vmas[NVMA]; v++){
+    if(v->f == 0 || addr < v->start || end > v->end)
+      continue;
+    if(addr != v->start && end != v->end)
+      return -1;
+    mmapunmap(curproc, v, addr, end);
+    return 0;
+  }
+  return -1;
+}
+
+// Return p's region covering va, or 0.
+static struct vma*
+findvma(struct proc *p, uint va)
+{
+  struct vma *v;
+
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++)
+    if(v->f && va >= v->start && va < v->end)
+      return v;
+  return 0;
+}
+
+// Handle a page fault at va in p, whose address space the
+// caller has locked with lockvm(); mmapfault() unlocks it.
+// Returns 1 if va belongs to no mapped region, 0 if the fault
+// was resolved (or should simply be retried), and -1 if the
+// access is not allowed.
+int
+mmapfault(struct proc *p, uint va, uint err)
+{
+  struct tlbbatch tb;
+  struct vma *v;
+  struct file *f;
+  pte_t *pte;
+  char *mem, *old;
+  uint off;
+  int perm, r;
+
+  if((v = findvma(p, va)) == 0){
+    unlockvm(p);
+    return 1;
+  }
+  if((err & FEC_WR) && !(v->prot & PROT_WRITE)){
+    unlockvm(p);
+    return -1;
+  }
+  va = PGROUNDDOWN(va);
+
+  pte = walkpgdir(p->pgdir, (char*)va, 0);
+  if(pte && (*pte & PTE_P)){
+    // Write to a present page: only copy-on-write is allowed.
+    r = -1;
+    if((err & FEC_WR) && (*pte & PTE_COW) && (mem = kalloc()) != 0){
+      old = P2V(PTE_ADDR(*pte));
+      memmove(mem, old, PGSIZE);
+      *pte = V2P(mem) | PTE_P | PTE_W | PTE_U;
+      tb.pgdir = p->pgdir;
+      tb.n = 0;
+      tlbinval(&tb, va);
+      tlbflush(&tb);
+      kfree(old);
+      r = 0;
+    }
+    unlockvm(p);
+    return r;
+  }
+
+  // Read the page with the address space unlocked: another
+  // thread may hold the inode's lock while it faults on a
+  // buffer of its own.  Our reference keeps the file open if
+  // the region is unmapped meanwhile.
+  f = filedup(v->f);
+  off = v->off + (va - v->start);
+  unlockvm(p);
+  if((mem = kalloc()) == 0){
+    fileclose(f);
+    return -1;
+  }
+  memset(mem, 0, PGSIZE);
+  ilock_shared(f->ip);
+  // Past end of file reads nothing and leaves zeroes.
+  readi(f->ip, mem, off, PGSIZE);
+  iunlock(f->ip);
+
+  // Install the page unless the region changed or another
+  // thread faulted it in meanwhile; then the access is retried.
+  lockvm(p);
+  r = 0;
+  v = findvma(p, va);
+  pte = walkpgdir(p->pgdir, (char*)va, 0);
+  if(v == 0 || v->f != f || v->off + (va - v->start) != off ||
+     (pte && (*pte & PTE_P))){
+    kfree(mem);
+  } else {
+    perm = PTE_U;
+    if(v->prot & PROT_WRITE)
+      perm |= PTE_W;
+    if(mappages(p->pgdir, (char*)va, PGSIZE, V2P(mem), perm) < 0){
+      kfree(mem);
+      r = -1;
+    }
+  }
+  unlockvm(p);
+  fileclose(f);
+  return r;
+}
+
+// Give np the regions of p.  The pages already faulted in
+// are shared with the child: writable for MAP_SHARED, and
+// read-only copy-on-write in both processes for MAP_PRIVATE.
+int
+mmapfork(struct proc *np, struct proc *p)
+{
+  struct tlbbatch tb;
+  struct vma *v;
+  pte_t *pte, *npte;
+  uint a;
+
+  tb.pgdir = p->pgdir;
+  tb.n = 0;
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++){
+    if(v->f == 0)
+      continue;
+    for(a = v->start; a < v->end; a += PGSIZE){
+      pte = walkpgdir(p->pgdir, (char*)a, 0);
+      if(pte == 0 || (*pte & PTE_P) == 0)
+        continue;
+      if((v->flags & MAP_PRIVATE) && (*pte & (PTE_W|PTE_COW))){
+        *pte = (*pte & ~PTE_W) | PTE_COW;
+        tlbinval(&tb, a);
+      }
+      if((npte = walkpgdir(np->pgdir, (char*)a, 1)) == 0){
+        // The caller's freevm(np->pgdir) drops the page
+        // references; drop the file references here.
+        tlbflush(&tb);
+        for(v = np->vmas; v < &np->vmas[NVMA]; v++){
+          if(v->f){
+            fileclose(v->f);
+            v->f = 0;
+          }
+        }
+        return -1;
+      }
+      *npte = *pte & ~PTE_D;
+      kref(P2V(PTE_ADDR(*pte)));
+    }
+    np->vmas[v - p->vmas] = *v;
+    filedup(v->f);
+  }
+  tlbflush(&tb);
+  return 0;
+}
+
+// Unmap all of the current process's regions.
+void
+mmapexit(void)
+{
+  struct proc *curproc = myproc()->leader;
+  struct vma *v;
+
+  for(v = curproc->vmas; v < &curproc->vmas[NVMA]; v++)
+    if(v->f)
+      mmapunmap(curproc, v, v->start, v->end);
+}
@@ -11,4 +11,21 @@
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       1000  // size of file system in blocks
+#define NTLBBATCH      32  // max TLB invalidations queued per shootdown
+#define NSHM         16  // maximum number of shared memory segments
+#define SHMPAGES    256  // maximum pages per shared memory segment
+#define NVMA          8  // memory-mapped file regions per process
 
+#define NPCACHE    1024  // maximum pages in the file page cache
+#define PCRESERVE  1024  // free pages the page cache leaves to others
+#define NMLFQ         4  // scheduler priority levels
+#define MLFQBOOST   100  // ticks between scheduler priority boosts
+#define NTICKETS    100  // default tickets per process (STRIDE)
+#define MAXTICKETS 1000  // maximum tickets per process
+#define IDLETICKS   100  // longest tickless halt on CPU 0
+#define TIMESLICE     1  // default timeslice in ticks, at MLFQ level 0
+#define MAXSLICE   1000  // longest timeslice
+#define NLATBUCKET   16  // buckets in the run queue wait histogram
+#define NMCSLOCK      4  // maximum number of MCS queue locks
+#define NLOCKCLASS   32  // maximum distinct lock names in lockstat
+#define SLEEPSPIN  1000  // pause loops acquiresleep spins before sleeping
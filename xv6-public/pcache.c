@@ -0,0 +1,232 @@
+// Page cache for file data.
+//
+// readi() and writei() keep whole pages of file contents here,
+// indexed by (device, inode number, page within the file), so
+// re-reading a warm file does not touch the disk or the small
+// block cache in bio.c.
+//
+// Pages come from kalloc().  The cache takes a fresh page on a
+// miss only while more than PCRESERVE pages are free; otherwise
+// it recycles its least recently used page.  When kalloc() runs
+// out it calls pcachereclaim() to take pages back, so the cache
+// grows into idle memory and shrinks under pressure.
+//
+// The interface mirrors bio.c:
+// * pcget() returns a locked page, possibly not yet valid, that
+//   the caller fills; pcfind() returns one only if it is cached.
+// * pcrelse() releases it.
+// Callers must hold the inode's lock, which keeps the page
+// contents consistent with the file.  writei() still writes
+// every block through the log and updates the cached copy.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "pcache.h"
+
+#define NPCHASH 61
+#define PCHASH(dev, inum, pgno) (((dev)*31 + (inum)*17 + (pgno)) % NPCHASH)
+
+struct {
+  struct spinlock lock;
+  struct cpage page[NPCACHE];
+  struct cpage *hash[NPCHASH];
+
+  // Linked list of all pages, through prev/next.
+  // head.next is most recently used.
+  struct cpage head;
+} pcache;
+
+void
+pcacheinit(void)
+{
+  struct cpage *c;
+
+  initlock(&pcache.lock, "pcache");
+  pcache.head.prev = &pcache.head;
+  pcache.head.next = &pcache.head;
+  for(c = pcache.page; c < pcache.page+NPCACHE; c++){
+    c->next = pcache.head.next;
+    c->prev = &pcache.head;
+    initsleeplock(&c->lock, "cpage");
+    pcache.head.next->prev = c;
+    pcache.head.next = c;
+  }
+}
+
+// Caller must hold pcache.lock.
+static struct cpage*
+pclookup(uint dev, uint inum, uint pgno)
+{
+  struct cpage *c;
+
+  for(c = pcache.hash[PCHASH(dev, inum, pgno)]; c; c = c->hnext)
+    if(c->dev == dev && c->inum == inum && c->pgno == pgno)
+      return c;
+  return 0;
+}
+
+// Remove c from its hash chain, if it is on one.
+// Caller must hold pcache.lock.
+static void
+pcunhash(struct cpage *c)
+{
+  struct cpage **pp;
+
+  if(c->inum == 0)
+    return;
+  for(pp = &pcache.hash[PCHASH(c->dev, c->inum, c->pgno)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == c){
+      *pp = c->hnext;
+      break;
+    }
+  }
+  c->inum = 0;
+  c->valid = 0;
+}
+
+// Return the locked page pgno of ip if it is cached, else 0.
+struct cpage*
+pcfind(struct inode *ip, uint pgno)
+{
+  struct cpage *c;
+
+  acquire(&pcache.lock);
+  if((c = pclookup(ip->dev, ip->inum, pgno)) != 0)
+    c->refcnt++;
+  release(&pcache.lock);
+  if(c)
+    acquiresleep(&c->lock);
+  return c;
+}
+
+// Return a locked page for page pgno of ip.  If it is not
+// valid the caller must fill it.  Returns 0 if every page is
+// in use and there is no memory for another.
+struct cpage*
+pcget(struct inode *ip, uint pgno)
+{
+  struct cpage *c;
+
+  if((c = pcfind(ip, pgno)) != 0)
+    return c;
+
+  acquire(&pcache.lock);
+  // Someone else may have added it while the lock was dropped.
+  if((c = pclookup(ip->dev, ip->inum, pgno)) != 0){
+    c->refcnt++;
+    release(&pcache.lock);
+    acquiresleep(&c->lock);
+    return c;
+  }
+
+  // Not cached; grow if memory is plentiful, else recycle
+  // the least recently used page.  kalloc() does not call
+  // back into pcachereclaim() while we hold pcache.lock.
+  for(c = pcache.head.prev; c != &pcache.head; c = c->prev){
+    if(c->refcnt != 0)
+      continue;
+    if(c->data == 0 && (kfreecount() <= PCRESERVE || (c->data = kalloc()) == 0))
+      continue;
+    pcunhash(c);
+    c->dev = ip->dev;
+    c->inum = ip->inum;
+    c->pgno = pgno;
+    c->refcnt = 1;
+    c->hnext = pcache.hash[PCHASH(c->dev, c->inum, pgno)];
+    pcache.hash[PCHASH(c->dev, c->inum, pgno)] = c;
+    release(&pcache.lock);
+    acquiresleep(&c->lock);
+    return c;
+  }
+  release(&pcache.lock);
+  return 0;
+}
+
+// Release a locked page.
+// Move to the head of the MRU list.
+void
+pcrelse(struct cpage *c)
+{
+  if(!holdingsleep(&c->lock))
+    panic("pcrelse");
+
+  releasesleep(&c->lock);
+
+  acquire(&pcache.lock);
+  c->refcnt--;
+  if(c->refcnt == 0){
+    c->next->prev = c->prev;
+    c->prev->next = c->next;
+    c->next = pcache.head.next;
+    c->prev = &pcache.head;
+    pcache.head.next->prev = c;
+    pcache.head.next = c;
+  }
+  release(&pcache.lock);
+}
+
+// Drop every cached page of ip, whose data blocks are
+// being freed.  Caller must hold ip->lock.
+void
+pcacheinval(struct inode *ip)
+{
+  struct cpage *c;
+
+  acquire(&pcache.lock);
+  for(c = pcache.page; c < pcache.page+NPCACHE; c++){
+    if(c->inum != ip->inum || c->dev != ip->dev)
+      continue;
+    if(c->refcnt != 0)
+      panic("pcacheinval");
+    pcunhash(c);
+  }
+  release(&pcache.lock);
+}
+
+// Give up to n unused pages back to kalloc(), least recently
+// used first.  Returns the number of pages freed.
+int
+pcachereclaim(int n)
+{
+  struct cpage *c;
+  int freed;
+
+  // kalloc() was called from inside pcget().
+  if(holding(&pcache.lock))
+    return 0;
+
+  freed = 0;
+  acquire(&pcache.lock);
+  for(c = pcache.head.prev; c != &pcache.head && freed < n; c = c->prev){
+    if(c->refcnt != 0 || c->data == 0)
+      continue;
+    pcunhash(c);
+    kfree(c->data);
+    c->data = 0;
+    freed++;
+  }
+  release(&pcache.lock);
+  return freed;
+}
+
+// Number of pages holding cached data or ready for reuse.
+int
+pcachecount(void)
+{
+  struct cpage *c;
+  int n;
+
+  n = 0;
+  acquire(&pcache.lock);
+  for(c = pcache.page; c < pcache.page+NPCACHE; c++)
+    if(c->data)
+      n++;
+  release(&pcache.lock);
+  return n;
+}
@@ -0,0 +1,13 @@
+// A page of file data in the page cache.
+struct cpage {
+  int valid;            // data holds the page's contents
+  uint dev;
+  uint inum;
+  uint pgno;            // page index within the file
+  struct sleeplock lock;
+  uint refcnt;
+  char *data;           // kalloc'd page, or 0
+  struct cpage *prev;   // LRU list
+  struct cpage *next;
+  struct cpage *hnext;  // hash chain
+};
@@ -6,24 +6,94 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "meminfo.h"
+#include "schedinfo.h"
+#include "traps.h"
 
+#define NPIDHASH 31
+
+// Live processes are also hashed by pid (through p->pidnext),
+// and each is on its parent's list of children (p->children,
+// through p->sibling), so that kill, wait and exit need not
+// scan the table.  Both are guarded by ptable.lock.
 struct {
   struct spinlock lock;
   struct proc proc[NPROC];
+  struct proc *pidhash[NPIDHASH];
 } ptable;
 
+// Per-CPU queue of RUNNABLE processes.
+//
+// Scheduling is a multi-level feedback queue: the queue has one
+// FIFO list per priority level and the scheduler runs the first
+// process of the highest non-empty level (0 is highest).  A process
+// that uses up its level's quantum of QUANTUM(p) timer ticks (its
+// timeslice, doubled at each level down) moves down a level;
+// mlfqboost() periodically moves every process back to level 0.
+//
+// Built with -D STRIDE instead (SCHEDULER in the Makefile), it
+// is a stride scheduler: each process advances its pass by a
+// stride inversely proportional to its tickets for every tick it
+// runs, and the queue is kept sorted so the lowest pass runs next.
+// A process runs for at least its timeslice before it is preempted.
+//
+// A process is queued on the CPU it last ran on, to find its
+// cache and TLB state still warm, unless its affinity mask
+// (setaffinity) rules that CPU out.  Idle CPUs steal only
+// processes whose mask allows them.
+//
+// A process is on the queue of at most one CPU, and only while
+// it is RUNNABLE.  A CPU's lock is held from the moment a process
+// running there decides to give up the CPU until the scheduler
+// has switched away from it, so taking the lock of p->cpu waits
+// for p to be off its kernel stack.  Lock order: ptable.lock,
+// then a run queue lock; never two run queue locks at once.
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NMLFQ];    // Next to run at each level, through p->rqnext
+  struct proc *tail[NMLFQ];
+  int n;                       // Number of processes queued
+  uint pass;                   // Highest pass chosen to run (STRIDE)
+} runqs[NCPU];
+
+// Sleeping processes, hashed by channel, so that wakeup()
+// looks only at processes that might be sleeping on its channel.
+// A sleeping process is on the list of SLEEPQ(p->chan), and its
+// lock guards p->chan and the change out of SLEEPING.
+// Lock order: ptable.lock, then a sleep queue lock, then a run
+// queue lock.
+#define NSLEEPQ 31
+struct sleepq {
+  struct spinlock lock;
+  struct proc *head;           // Through p->slnext
+} sleepqs[NSLEEPQ];
+
+#define SLEEPQ(chan) (&sleepqs[(uint)(chan) / 4 % NSLEEPQ])
+
+#define QUANTUM(p) ((p)->slice << (p)->level)
+#define ALLOWED(p, cpu) ((p)->affinity & (1 << (cpu)))
+#define STRIDE1 (1 << 16)
+
 static struct proc *initproc;
 
 int nextpid = 1;
 extern void forkret(void);
 extern void trapret(void);
 
-static void wakeup1(void *chan);
+static void unsleep(struct proc*);
+static void pageinit(struct proc*);
+static int pagecopy(struct proc*, struct proc*);
 
 void
 pinit(void)
 {
-  initlock(&ptable.lock, "ptable");
+  int i;
+
+  initmcslock(&ptable.lock, "ptable");
+  for(i = 0; i < NCPU; i++)
+    initlock(&runqs[i].lock, "runq");
+  for(i = 0; i < NSLEEPQ; i++)
+    initlock(&sleepqs[i].lock, "sleepq");
 }
 
 // Must be called with interrupts disabled
@@ -32,37 +102,383 @@ cpuid() {
   return mycpu()-cpus;
 }
 
+// seginit() points %gs at this CPU's struct cpu.
 // Must be called with interrupts disabled to avoid the caller being
-// rescheduled between reading lapicid and running through the loop.
+// rescheduled onto another CPU while it uses the result.
 struct cpu*
 mycpu(void)
 {
-  int apicid, i;
-  
+  struct cpu *c;
+
   if(readeflags()&FL_IF)
     panic("mycpu called with interrupts enabled\n");
-  
-  apicid = lapicid();
-  // APIC IDs are not guaranteed to be contiguous. Maybe we should have
-  // a reverse map, or reserve a register to store &cpus[i].
-  for (i = 0; i < ncpu; ++i) {
-    if (cpus[i].apicid == apicid)
-      return &cpus[i];
-  }
-  panic("unknown apicid\n");
+  asm volatile("movl %%gs:0, %0" : "=r" (c));
+  return c;
 }
 
-// Disable interrupts so that we are not rescheduled
-// while reading proc from the cpu structure
+// Add n to this CPU's counter i (CNT_ in proc.h).  One add
+// through %gs, which an interrupt cannot split, so it needs
+// no lock or pushcli and writes only this CPU's cache line.
+void
+cpucount(int i, uint n)
+{
+  asm volatile("addl %1, %%gs:(%0)"
+               : : "r" (__builtin_offsetof(struct cpu, count) + i*sizeof(uint)),
+                   "r" (n)
+               : "memory");
+}
+
+// Sum of counter i over all CPUs.  Not a snapshot: other CPUs
+// may be counting meanwhile.
+uint
+cpucounts(int i)
+{
+  struct cpu *c;
+  uint n;
+
+  n = 0;
+  for(c = cpus; c < &cpus[ncpu]; c++)
+    n += c->count[i];
+  return n;
+}
+
+// A single load is not split by an interrupt, and the process
+// running on whichever CPU does it is the caller, so there is
+// no need to disable interrupts.
 struct proc*
 myproc(void) {
-  struct cpu *c;
   struct proc *p;
+
+  asm volatile("movl %%gs:%c1, %0"
+               : "=r" (p) : "i" (__builtin_offsetof(struct cpu, proc)));
+  return p;
+}
+
+//PAGEBREAK: 20
+// Append p to rq at its priority level.
+// Caller must hold rq->lock.
+static void
+rqpush(struct runq *rq, struct proc *p)
+{
+#ifdef STRIDE
+  struct proc **pp;
+#endif
+
+  p->readyat = rdtsc();
+#ifdef STRIDE
+
+  // A process that slept must not bank the time it missed.
+  // Passes wrap, so compare their difference.
+  if((int)(p->pass - rq->pass) < 0)
+    p->pass = rq->pass;
+  for(pp = &rq->head[0]; *pp && (int)((*pp)->pass - p->pass) <= 0; pp = &(*pp)->rqnext)
+    ;
+  p->rqnext = *pp;
+  *pp = p;
+  if(p->rqnext == 0)
+    rq->tail[0] = p;
+#else
+  p->rqnext = 0;
+  if(rq->tail[p->level])
+    rq->tail[p->level]->rqnext = p;
+  else
+    rq->head[p->level] = p;
+  rq->tail[p->level] = p;
+#endif
+  rq->n++;
+}
+
+// Unlink p, which follows prev (0 if it is first), from
+// level i of rq.  Caller must hold rq->lock.
+static void
+rqunlink(struct runq *rq, int i, struct proc *prev, struct proc *p)
+{
+  if(prev)
+    prev->rqnext = p->rqnext;
+  else
+    rq->head[i] = p->rqnext;
+  if(rq->tail[i] == p)
+    rq->tail[i] = prev;
+  rq->n--;
+}
+
+// Remove and return the first process of the highest level
+// of rq that may run on cpu, or 0.  Caller must hold rq->lock.
+static struct proc*
+rqpop(struct runq *rq, int cpu)
+{
+  struct proc *p, *prev;
+  int i;
+
+  for(i = 0; i < NMLFQ; i++){
+    prev = 0;
+    for(p = rq->head[i]; p; prev = p, p = p->rqnext){
+      if(!ALLOWED(p, cpu))
+        continue;
+      rqunlink(rq, i, prev, p);
+#ifdef STRIDE
+      if((int)(p->pass - rq->pass) > 0)
+        rq->pass = p->pass;
+#endif
+      return p;
+    }
+  }
+  return 0;
+}
+
+// Does rq hold a process that may run on cpu?
+static int
+rqcanrun(struct runq *rq, int cpu)
+{
+  struct proc *p;
+  int i, found;
+
+  found = 0;
+  acquire(&rq->lock);
+  for(i = 0; i < NMLFQ && !found; i++)
+    for(p = rq->head[i]; p && !found; p = p->rqnext)
+      found = ALLOWED(p, cpu);
+  release(&rq->lock);
+  return found;
+}
+
+// Remove p from rq if it is there.  Returns 1 if it was.
+// Caller must hold rq->lock.
+static int
+rqremove(struct runq *rq, struct proc *p)
+{
+  struct proc *q, *prev;
+  int i;
+
+  for(i = 0; i < NMLFQ; i++){
+    prev = 0;
+    for(q = rq->head[i]; q; prev = q, q = q->rqnext){
+      if(q == p){
+        rqunlink(rq, i, prev, p);
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+// Lock and return the current CPU's run queue.
+static struct runq*
+lockmyrq(void)
+{
+  struct runq *rq;
+
   pushcli();
-  c = mycpu();
-  p = c->proc;
+  rq = &runqs[cpuid()];
+  acquire(&rq->lock);
   popcli();
-  return p;
+  return rq;
+}
+
+// Release the run queue lock that a process holds when
+// it starts or resumes running: that of its current CPU,
+// not necessarily the one it called sched() with.
+static void
+unlockmyrq(void)
+{
+  release(&runqs[cpuid()].lock);
+}
+
+// Halt this CPU until an interrupt arrives, unless some run
+// queue already has work.  Other CPUs stop their timer while
+// halted; CPU 0 keeps ticks, so it sets a one-shot timer for
+// the next pending timer and adds the ticks it slept through
+// when it wakes.  It halts one tick at a time while any other
+// CPU is busy, since those may read ticks.
+static void
+idle(struct cpu *c)
+{
+  struct runq *rq;
+  struct cpu *o;
+  uint64 t;
+  uint n;
+
+  cli();
+  c->idle = 1;
+  // Pairs with kick(): either we see the new process
+  // or the waker sees c->idle and sends T_WAKEUP.
+  __sync_synchronize();
+  for(rq = runqs; rq < &runqs[ncpu]; rq++){
+    if(rq->n > 0 && rqcanrun(rq, c - cpus)){
+      c->idle = 0;
+      sti();
+      return;
+    }
+  }
+
+  n = 0;
+  if(c == &cpus[0]){
+    acquire(&tickslock);
+    n = timernext();
+    release(&tickslock);
+    if(n == 0 || n > IDLETICKS)
+      n = IDLETICKS;
+    for(o = cpus; o < &cpus[ncpu]; o++)
+      if(o != c && !o->idle)
+        n = 1;
+  }
+  lapictickless(n);
+  t = rdtsc();
+  stihlt();
+  cli();
+  c->idlecycles += rdtsc() - t;
+  n = lapicticking();
+  c->idle = 0;
+  __sync_synchronize();
+
+  if(c == &cpus[0]){
+    if(n > 0){
+      acquire(&tickslock);
+      ticks += n;
+      timertick();
+      release(&tickslock);
+#ifdef MLFQ
+      if(ticks/MLFQBOOST != (ticks-n)/MLFQBOOST)
+        mlfqboost();
+#endif
+    }
+  } else if(cpus[0].idle){
+    // CPU 0 may be in a long halt; make it tick again.
+    lapicipi(cpus[0].apicid, T_WAKEUP);
+  }
+  sti();
+}
+
+// rq has just been given p.  Wake its CPU if that is halted
+// in idle(), or else some other halted CPU p may run on, to
+// steal it.
+static void
+kick(struct runq *rq, struct proc *p)
+{
+  struct cpu *c, *me;
+
+  __sync_synchronize();
+  pushcli();
+  me = mycpu();
+  c = &cpus[rq - runqs];
+  if(!c->idle){
+    for(c = cpus; c < &cpus[ncpu]; c++)
+      if(c != me && c->idle && ALLOWED(p, c - cpus))
+        break;
+  }
+  if(c < &cpus[ncpu] && c != me && c->idle)
+    lapicipi(c->apicid, T_WAKEUP);
+  popcli();
+}
+
+// Histogram bucket for a run queue wait of t cycles
+// (see schedinfo.h).
+static int
+latbucket(uint64 t)
+{
+  int i;
+
+  t >>= 10;
+  for(i = 0; i < NLATBUCKET-1 && t > 1; i++)
+    t >>= 1;
+  return i;
+}
+
+// Return the CPU allowed by p's affinity mask with the
+// fewest queued processes.
+static int
+affinecpu(struct proc *p)
+{
+  int i, best;
+
+  best = -1;
+  for(i = 0; i < ncpu; i++)
+    if(ALLOWED(p, i) && (best < 0 || runqs[i].n < runqs[best].n))
+      best = i;
+  return best;
+}
+
+// Make p RUNNABLE on the queue of the CPU it last ran on,
+// or of another if its affinity mask rules that one out.
+// If p is still switching out there, this waits until it
+// is done, even if p then moves.  Caller must hold p's sleep
+// queue lock if p is SLEEPING, or ptable.lock if it is new.
+static void
+setrunnable(struct proc *p)
+{
+  struct runq *rq;
+
+  if(!ALLOWED(p, p->cpu)){
+    // sleep() holds the old queue's lock until p is switched
+    // out; another CPU must not run p before then.
+    acquire(&runqs[p->cpu].lock);
+    release(&runqs[p->cpu].lock);
+    p->cpu = affinecpu(p);
+  }
+  rq = &runqs[p->cpu];
+  acquire(&rq->lock);
+  p->state = RUNNABLE;
+  rqpush(rq, p);
+  release(&rq->lock);
+  kick(rq, p);
+}
+
+// Take the first process that may run here off the busiest
+// other run queue, trying the next busiest if it has none.
+// Returns it with no lock held, or 0 if there is none.
+static struct proc*
+steal(struct runq *self)
+{
+  struct runq *rq, *busiest;
+  struct proc *p;
+  uint tried;
+
+  tried = 1 << (self - runqs);
+  for(;;){
+    // Queue lengths are only a hint; check again under the lock.
+    busiest = 0;
+    for(rq = runqs; rq < &runqs[ncpu]; rq++)
+      if(!(tried & (1 << (rq - runqs))) && rq->n > 0 &&
+         (busiest == 0 || rq->n > busiest->n))
+        busiest = rq;
+    if(busiest == 0)
+      return 0;
+    acquire(&busiest->lock);
+    p = rqpop(busiest, self - runqs);
+    release(&busiest->lock);
+    if(p)
+      return p;
+    tried |= 1 << (busiest - runqs);
+  }
+}
+
+// Make p, a new process, visible to findproc() and wait().
+// Caller must hold ptable.lock.
+static void
+linkproc(struct proc *p)
+{
+  struct proc **h = &ptable.pidhash[p->pid % NPIDHASH];
+
+  p->pidnext = *h;
+  *h = p;
+  p->children = 0;
+  if(p->parent){
+    p->sibling = p->parent->children;
+    p->parent->children = p;
+  }
+}
+
+// Return the live process with the given pid, or 0.
+// Caller must hold ptable.lock.
+static struct proc*
+findproc(int pid)
+{
+  struct proc *p;
+
+  for(p = ptable.pidhash[pid % NPIDHASH]; p; p = p->pidnext)
+    if(p->pid == pid)
+      return p;
+  return 0;
 }
 
 //PAGEBREAK: 32
@@ -100,7 +516,24 @@ found:
   // Leave room for trap frame.
   sp -= sizeof *p->tf;
   p->tf = (struct trapframe*)sp;
-  p->size = 0;
+  pageinit(p);
+  p->level = 0;
+  p->qticks = 0;
+  p->slice = TIMESLICE;
+  p->waitcycles = 0;
+  p->nrun = 0;
+  p->nvol = 0;
+  p->ninvol = 0;
+  p->affinity = ~0;
+  p->tickets = NTICKETS;
+  p->stride = STRIDE1 / NTICKETS;
+  p->pass = 0;
+  p->shmmask = 0;
+  memset(p->vmas, 0, sizeof(p->vmas));
+  p->leader = p;
+  p->nthread = 1;
+  p->vmbusy = 0;
+  p->nshared = 0;
   // Set up new context to start executing at forkret,
   // which returns to trapret.
   sp -= 4;
@@ -154,30 +587,90 @@ userinit(void)
   // because the assignment might not be atomic.
   acquire(&ptable.lock);
 
-  p->state = RUNNABLE;
+  p->parent = 0;
+  linkproc(p);
+  p->cpu = 0;
+  setrunnable(p);
   //cprintf("\nINITTED\n");
   release(&ptable.lock);
 }
 
-// Grow current process's memory by n bytes.
-// Return 0 on success, -1 on failure.
+// Lock the address space p shares with its threads: its size,
+// page table and paging state.  Held across page faults, so it
+// sleeps rather than spins; the caller must not touch user
+// memory that might fault while holding it.
+void
+lockvm(struct proc *p)
+{
+  p = p->leader;
+  acquire(&ptable.lock);
+  while(xchg(&p->vmbusy, 1) != 0)
+    sleep((void*)&p->vmbusy, &ptable.lock);
+  release(&ptable.lock);
+}
+
+// Lock p's address space if that can be done without waiting.
+// Safe in an interrupt handler.  Returns 1 if locked.
+int
+trylockvm(struct proc *p)
+{
+  return xchg(&p->leader->vmbusy, 1) == 0;
+}
+
+void
+unlockvm(struct proc *p)
+{
+  p = p->leader;
+  acquire(&ptable.lock);
+  p->vmbusy = 0;
+  wakeup((void*)&p->vmbusy);
+  release(&ptable.lock);
+}
+
+// Set the size of p's address space in p and all its threads.
+// Caller must hold ptable.lock.
+static void
+setsz(struct proc *p, uint sz)
+{
+  struct proc *t;
+
+  p = p->leader;
+  p->sz = sz;
+  for(t = p->children; t; t = t->sibling)
+    if(t->leader == p)
+      t->sz = sz;
+}
+
+// Grow current process's memory by n bytes.  Growing is
+// lazy: pages are allocated when first touched (see trap.c).
+// Shrinking gives back whatever has been touched.
+// Return the old size, or -1 on failure.
 int
 growproc(int n)
 {
-  uint sz;
+  uint oldsz, sz;
   struct proc *curproc = myproc();
 
-  sz = curproc->sz;
+  lockvm(curproc);
+  oldsz = sz = curproc->leader->sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    if(sz + n >= MMAPBASE){
+      unlockvm(curproc);
       return -1;
+    }
+    sz += n;
   } else if(n < 0){
-    if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0){
+      unlockvm(curproc);
       return -1;
+    }
+    pagedrop(curproc->leader, PGROUNDUP(sz), oldsz);
   }
-  curproc->sz = sz;
-  switchuvm(curproc);
-  return 0;
+  acquire(&ptable.lock);
+  setsz(curproc, sz);
+  release(&ptable.lock);
+  unlockvm(curproc);
+  return oldsz;
 }
 
 // Create a new process copying p as the parent.
@@ -196,13 +689,32 @@ cprintf("[][][]trying to fork[][][]");
     return -1;
   }
 
-  // Copy process state from proc.
+  // Before lockvm: faults must not wait on file system locks.
+  createSwapFile(np);
+
+  // Copy process state from proc.  Our threads may be
+  // faulting pages in; hold the address space still.
+  lockvm(curproc);
   if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
+    unlockvm(curproc);
+    removeSwapFile(np);
     kfree(np->kstack);
     np->kstack = 0;
     np->state = UNUSED;
     return -1;
   }
+  if(shmfork(np, curproc->leader) < 0 || mmapfork(np, curproc->leader) < 0 ||
+     pagecopy(np, curproc->leader) < 0){
+    unlockvm(curproc);
+    removeSwapFile(np);
+    freevm(np->pgdir);
+    shmexec(np);
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+  unlockvm(curproc);
   np->sz = curproc->sz;
   np->parent = curproc;
   *np->tf = *curproc->tf;
@@ -216,6 +728,11 @@ cprintf("[][][]trying to fork[][][]");
   np->cwd = idup(curproc->cwd);
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+  np->slice = curproc->slice;
+  np->affinity = curproc->affinity;
+  np->tickets = curproc->tickets;
+  np->stride = curproc->stride;
+  np->pass = curproc->pass;
   
   /*//Copy swapFile from the parent process to the child process.
   char buffer[4096];
@@ -288,19 +805,142 @@ cprintf("[][][]trying to fork[][][]");
 	np->tail = curproc->tail;
 	np->size = curproc->size;
     #endif*/
-	createSwapFile(np);
 
   pid = np->pid;
 
   acquire(&ptable.lock);
 
-  np->state = RUNNABLE;
+  linkproc(np);
+  // Start on the parent's CPU; idle CPUs will steal it.
+  np->cpu = curproc->cpu;
+  setrunnable(np);
 
   release(&ptable.lock);
 
   return pid;
 }
 
+// Create a thread that runs fn(arg) on the one-page user stack
+// at stack.  It shares the current process's address space,
+// paging state and open files, and is reaped with join().
+// fn must call exit() rather than return.
+// Returns the new thread's pid, or -1.
+int
+clone(void (*fn)(void*), void *arg, void *stack)
+{
+  int i, pid;
+  struct proc *np;
+  struct proc *curproc = myproc();
+  struct proc *leader = curproc->leader;
+  uint *sp;
+
+  // Push arg and a fake return PC.  Do it before taking any
+  // lock, since the stack page may not be faulted in yet.
+  sp = (uint*)((char*)stack + PGSIZE);
+  *--sp = (uint)arg;
+  *--sp = 0xffffffff;
+
+  if((np = allocproc()) == 0)
+    return -1;
+  np->pgdir = curproc->pgdir;
+  np->leader = leader;
+  np->parent = leader;
+  np->ustack = stack;
+  *np->tf = *curproc->tf;
+  np->tf->eip = (uint)fn;
+  np->tf->esp = (uint)sp;
+
+  for(i = 0; i < NOFILE; i++)
+    if(curproc->ofile[i])
+      np->ofile[i] = filedup(curproc->ofile[i]);
+  np->cwd = idup(curproc->cwd);
+
+  safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+  np->slice = curproc->slice;
+  np->affinity = curproc->affinity;
+  np->tickets = curproc->tickets;
+  np->stride = curproc->stride;
+  np->pass = curproc->pass;
+
+  pid = np->pid;
+
+  acquire(&ptable.lock);
+
+  np->sz = leader->sz;
+  leader->nthread++;
+  linkproc(np);
+  // Start on our CPU; idle CPUs will steal it.
+  np->cpu = curproc->cpu;
+  setrunnable(np);
+
+  release(&ptable.lock);
+
+  return pid;
+}
+
+// Free zombie *pp and unlink it from its parent's children
+// and the pid hash.  Returns its pid.  Caller must hold
+// ptable.lock.
+static int
+reap(struct proc **pp)
+{
+  struct proc *p = *pp;
+  int pid;
+
+  // Make sure it is off its stack.
+  acquire(&runqs[p->cpu].lock);
+  release(&runqs[p->cpu].lock);
+  *pp = p->sibling;
+  for(pp = &ptable.pidhash[p->pid % NPIDHASH]; *pp != p; pp = &(*pp)->pidnext)
+    ;
+  *pp = p->pidnext;
+  pid = p->pid;
+  kfree(p->kstack);
+  p->kstack = 0;
+  // A thread's page table belongs to its leader.
+  if(p->leader == p)
+    freevm(p->pgdir);
+  p->pgdir = 0;
+  p->pid = 0;
+  p->parent = 0;
+  p->name[0] = 0;
+  p->killed = 0;
+  p->state = UNUSED;
+  return pid;
+}
+
+// Kill the threads of leader p and reap them.  Returns once
+// p is the only user of its address space.  Scans at least
+// once: threads that already exited unjoined are zombies that
+// nthread no longer counts.
+static void
+stopthreads(struct proc *p)
+{
+  struct proc *t, **pp;
+
+  acquire(&ptable.lock);
+  for(;;){
+    for(pp = &p->children; (t = *pp) != 0; ){
+      if(t->leader != p){
+        pp = &t->sibling;
+        continue;
+      }
+      if(t->state == ZOMBIE){
+        reap(pp);
+        continue;
+      }
+      t->killed = 1;
+      unsleep(t);
+      pp = &t->sibling;
+    }
+    if(p->nthread == 1)
+      break;
+    // Thread exits wake us, as they would wait().
+    sleep(p, &ptable.lock);
+  }
+  release(&ptable.lock);
+}
+
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait() to find out it exited.
@@ -314,6 +954,13 @@ exit(void)
   if(curproc == initproc)
     panic("init exiting");
 
+  // The address space goes only with its last user.
+  if(curproc->leader == curproc){
+    stopthreads(curproc);
+    // Write back and unmap mapped files.
+    mmapexit();
+  }
+
   // Close all open files.
   for(fd = 0; fd < NOFILE; fd++){
     if(curproc->ofile[fd]){
@@ -326,32 +973,42 @@ exit(void)
   iput(curproc->cwd);
   end_op();
   curproc->cwd = 0;
-  int i = 0;
-  for(i = 0; i < 30; i++)
-  {
-    if(curproc->pages[i]->swapped == 0)
-    {
-	kfree((char *)curproc->pages[i]->address);    
-    }
+  if(curproc->leader == curproc){
+    shmexit();
+    // The frames go with the page table in wait(); pages[]
+    // records hold user addresses, not frames to free.
+    removeSwapFile(curproc);
   }
-  removeSwapFile(curproc);
 	
   acquire(&ptable.lock);
 
-  // Parent might be sleeping in wait().
-  wakeup1(curproc->parent);
+  if(curproc->leader != curproc)
+    curproc->leader->nthread--;
+
+  // Parent might be sleeping in wait(), or, for a thread,
+  // its leader's threads in join() or stopthreads().
+  wakeup(curproc->parent);
 
   // Pass abandoned children to init.
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->parent == curproc){
+  if(curproc->children){
+    for(p = curproc->children; ; p = p->sibling){
       p->parent = initproc;
       if(p->state == ZOMBIE)
-        wakeup1(initproc);
+        wakeup(initproc);
+      if(p->sibling == 0)
+        break;
     }
+    p->sibling = initproc->children;
+    initproc->children = curproc->children;
+    curproc->children = 0;
   }
 
   // Jump into the scheduler, never to return.
+  // wait() frees our stack only once it can take our
+  // run queue lock, after we have switched out.
   curproc->state = ZOMBIE;
+  lockmyrq();
+  release(&ptable.lock);
   sched();
   panic("zombie exit");
 }
@@ -361,29 +1018,21 @@ exit(void)
 int
 wait(void)
 {
-  struct proc *p;
+  struct proc *p, **pp;
   int havekids, pid;
   struct proc *curproc = myproc();
   
   acquire(&ptable.lock);
   for(;;){
-    // Scan through table looking for exited children.
+    // Scan through our children looking for exited ones.
     havekids = 0;
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->parent != curproc)
-        continue;
+    for(pp = &curproc->children; (p = *pp) != 0; pp = &p->sibling){
+      if(p->leader != p)
+        continue;  // A thread; see join().
       havekids = 1;
       if(p->state == ZOMBIE){
         // Found one.
-        pid = p->pid;
-        kfree(p->kstack);
-        p->kstack = 0;
-        freevm(p->pgdir);
-        p->pid = 0;
-        p->parent = 0;
-        p->name[0] = 0;
-        p->killed = 0;
-        p->state = UNUSED;
+        pid = reap(pp);
         release(&ptable.lock);
         return pid;
       }
@@ -395,16 +1044,56 @@ wait(void)
       return -1;
     }
 
-    // Wait for children to exit.  (See wakeup1 call in proc_exit.)
+    // Wait for children to exit.  (See wakeup call in proc_exit.)
     sleep(curproc, &ptable.lock);  //DOC: wait-sleep
   }
 }
 
+// Wait for a thread of the current process to exit and
+// return its pid, storing the stack it was given to clone()
+// in *stack.  Return -1 if the process has no other threads.
+int
+join(void **stack)
+{
+  struct proc *p, **pp;
+  int havethreads, pid;
+  void *ustack;
+  struct proc *curproc = myproc();
+  struct proc *leader = curproc->leader;
+
+  acquire(&ptable.lock);
+  for(;;){
+    havethreads = 0;
+    for(pp = &leader->children; (p = *pp) != 0; pp = &p->sibling){
+      if(p->leader != leader || p == curproc)
+        continue;
+      havethreads = 1;
+      if(p->state == ZOMBIE){
+        ustack = p->ustack;
+        pid = reap(pp);
+        release(&ptable.lock);
+        // May fault, so not under ptable.lock.
+        *stack = ustack;
+        return pid;
+      }
+    }
+
+    if(!havethreads || curproc->killed){
+      release(&ptable.lock);
+      return -1;
+    }
+
+    // Thread exits wake their leader.
+    sleep(leader, &ptable.lock);
+  }
+}
+
 //PAGEBREAK: 42
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run
+//  - choose a process from this CPU's run queue, or
+//      steal one from the busiest other queue
 //  - swtch to start running that process
 //  - eventually that process transfers control
 //      via swtch back to the scheduler.
@@ -413,37 +1102,55 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
-  //int v = 0;
+  struct runq *rq = &runqs[cpuid()];
+  uint64 t;
+
   c->proc = 0;
+  c->tsc0 = rdtsc();
   for(;;){
     // Enable interrupts on this processor.
     sti();
-    // Loop over process table looking for process to run.
-    acquire(&ptable.lock);
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    //cprintf("%d", v);
-    //v++;
-      if(p->state != RUNNABLE)
+
+    acquire(&rq->lock);
+    if((p = rqpop(rq, rq - runqs)) == 0){
+      release(&rq->lock);
+      if((p = steal(rq)) == 0){
+        idle(c);
         continue;
-      // Switch to chosen process.  It is the process's job
-      // to release ptable.lock and then reacquire it
-      // before jumping back to us
-      c->proc = p;
-      switchuvm(p);
-      p->state = RUNNING;
-      swtch(&(c->scheduler), p->context);
-      switchkvm();
-
-      // Process is done running for now.
-      // It should have changed its p->state before coming back.
-      c->proc = 0;
+      }
+      acquire(&rq->lock);
     }
-    release(&ptable.lock);
 
+    // Account for the time p spent queued.
+    t = rdtsc() - p->readyat;
+    p->waitcycles += t;
+    p->nrun++;
+    c->lat[latbucket(t)]++;
+
+    // Switch to chosen process.  It is the process's job
+    // to release rq->lock and then reacquire it
+    // before jumping back to us.
+    c->proc = p;
+    p->cpu = rq - runqs;
+    switchuvm(p);
+    p->state = RUNNING;
+    swtch(&(c->scheduler), p->context);
+    switchkvm();
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    p = c->migrate;
+    c->migrate = 0;
+    release(&rq->lock);
+
+    // It yielded on a CPU its mask no longer allows.
+    if(p)
+      setrunnable(p);
   }
 }
 
-// Enter scheduler.  Must hold only ptable.lock
+// Enter scheduler.  Must hold only this CPU's run queue lock
 // and have changed proc->state. Saves and restores
 // intena because intena is a property of this
 // kernel thread, not this CPU. It should
@@ -456,14 +1163,21 @@ sched(void)
   int intena;
   struct proc *p = myproc();
 
-  if(!holding(&ptable.lock))
-    panic("sched ptable.lock");
+  if(!holding(&runqs[cpuid()].lock))
+    panic("sched runq lock");
   if(mycpu()->ncli != 1)
     panic("sched locks");
   if(p->state == RUNNING)
     panic("sched running");
   if(readeflags()&FL_IF)
     panic("sched interruptible");
+  if(p->state == RUNNABLE){
+    p->ninvol++;
+    mycpu()->ninvol++;
+  } else {
+    p->nvol++;
+    mycpu()->nvol++;
+  }
   intena = mycpu()->intena;
   swtch(&p->context, mycpu()->scheduler);
   mycpu()->intena = intena;
@@ -473,10 +1187,166 @@ sched(void)
 void
 yield(void)
 {
-  acquire(&ptable.lock);  //DOC: yieldlock
-  myproc()->state = RUNNABLE;
+  struct proc *p = myproc();
+  struct runq *rq;
+
+  rq = lockmyrq();  //DOC: yieldlock
+  p->state = RUNNABLE;
+  if(ALLOWED(p, rq - runqs))
+    rqpush(rq, p);
+  else
+    mycpu()->migrate = p;  // scheduler() queues it elsewhere
   sched();
+  unlockmyrq();
+}
+
+// Charge the current process for a timer tick.  Returns 1 if it
+// should yield: it has used up its quantum, which moves it down
+// a level, or a higher-priority process is waiting on this CPU.
+// With STRIDE, it should yield once its timeslice is used up
+// and a queued process has a lower pass.
+// Called from trap() with interrupts off.
+int
+proctick(void)
+{
+  struct proc *p = myproc();
+  struct runq *rq;
+#ifdef STRIDE
+  p->pass += p->stride;
+  if(++p->qticks < p->slice)
+    return 0;
+  rq = &runqs[cpuid()];
+  if(rq->head[0] && (int)(rq->head[0]->pass - p->pass) < 0){
+    p->qticks = 0;
+    return 1;
+  }
+  return 0;
+#else
+  int i;
+
+  if(++p->qticks >= QUANTUM(p)){
+    if(p->level < NMLFQ-1)
+      p->level++;
+    p->qticks = 0;
+    return 1;
+  }
+  rq = &runqs[cpuid()];
+  for(i = 0; i < p->level; i++)
+    if(rq->head[i])
+      return 1;
+  return 0;
+#endif
+}
+
+// Give the current process n tickets, for a CPU share
+// proportional to n under the STRIDE scheduler.
+int
+settickets(int n)
+{
+  struct proc *p = myproc();
+
+  if(n < 1 || n > MAXTICKETS)
+    return -1;
+  p->tickets = n;
+  p->stride = STRIDE1 / n;
+  return 0;
+}
+
+// Restrict process pid to the CPUs in mask (bit i for CPU i).
+// A queued process moves at once; a running or sleeping one
+// when it next yields or wakes up.
+int
+setaffinity(int pid, uint mask)
+{
+  struct proc *p;
+  struct runq *rq;
+  int queued;
+
+  mask &= (1 << ncpu) - 1;
+  if(mask == 0)
+    return -1;
+  acquire(&ptable.lock);
+  if((p = findproc(pid)) == 0){
+    release(&ptable.lock);
+    return -1;
+  }
+  p->affinity = mask;
+  // If p is not on that queue it is running or in transit,
+  // and moves when it next yields.
+  rq = &runqs[p->cpu];
+  acquire(&rq->lock);
+  queued = !ALLOWED(p, rq - runqs) && rqremove(rq, p);
+  release(&rq->lock);
+  if(queued)
+    setrunnable(p);
   release(&ptable.lock);
+  if(p == myproc())
+    yield();
+  return 0;
+}
+
+// Set the current process's timeslice to n ticks: the time it
+// runs before the timer makes it yield (at level 0 under MLFQ).
+int
+settimeslice(int n)
+{
+  if(n < 1 || n > MAXSLICE)
+    return -1;
+  myproc()->slice = n;
+  return 0;
+}
+
+// Move every process back to level 0, so that CPU-bound
+// processes that sank to the bottom are not starved.
+void
+mlfqboost(void)
+{
+  struct runq *rq;
+  struct proc *p;
+  int i;
+
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->state != RUNNABLE){
+      p->level = 0;
+      p->qticks = 0;
+    }
+  }
+  // Queued processes must move lists as well.
+  for(rq = runqs; rq < &runqs[ncpu]; rq++){
+    acquire(&rq->lock);
+    for(i = 1; i < NMLFQ; i++){
+      if(rq->head[i] == 0)
+        continue;
+      for(p = rq->head[i]; p; p = p->rqnext){
+        p->level = 0;
+        p->qticks = 0;
+      }
+      if(rq->tail[0])
+        rq->tail[0]->rqnext = rq->head[i];
+      else
+        rq->head[0] = rq->head[i];
+      rq->tail[0] = rq->tail[i];
+      rq->head[i] = rq->tail[i] = 0;
+    }
+    release(&rq->lock);
+  }
+  release(&ptable.lock);
+}
+
+// Return the scheduling level of process pid, or -1.
+int
+getlevel(int pid)
+{
+  struct proc *p;
+  int level;
+
+  level = -1;
+  acquire(&ptable.lock);
+  if((p = findproc(pid)) != 0)
+    level = p->level;
+  release(&ptable.lock);
+  return level;
 }
 
 // A fork child's very first scheduling by scheduler()
@@ -485,8 +1355,8 @@ void
 forkret(void)
 {
   static int first = 1;
-  // Still holding ptable.lock from scheduler.
-  release(&ptable.lock);
+  // Still holding the run queue lock from scheduler.
+  unlockmyrq();
 
   if (first) {
     // Some initialization functions must be run in the context
@@ -506,6 +1376,7 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct sleepq *sq;
   
   if(p == 0)
     panic("sleep");
@@ -513,52 +1384,78 @@ sleep(void *chan, struct spinlock *lk)
   if(lk == 0)
     panic("sleep without lk");
 
-  // Must acquire ptable.lock in order to
-  // change p->state and then call sched.
-  // Once we hold ptable.lock, we can be
-  // guaranteed that we won't miss any wakeup
-  // (wakeup runs with ptable.lock locked),
+  // Must acquire chan's sleep queue lock in order to
+  // change p->state.
+  // Once we hold it, we can be guaranteed that we won't
+  // miss any wakeup (wakeup runs with it locked),
   // so it's okay to release lk.
-  if(lk != &ptable.lock){  //DOC: sleeplock0
-    acquire(&ptable.lock);  //DOC: sleeplock1
-    release(lk);
-  }
+  sq = SLEEPQ(chan);
+  acquire(&sq->lock);  //DOC: sleeplock1
+  release(lk);
+
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->slnext = sq->head;
+  sq->head = p;
 
+  // A wakeup that finds us now waits on this CPU's
+  // run queue lock until we have switched out.
+  lockmyrq();
+  release(&sq->lock);
   sched();
+  unlockmyrq();
 
-  // Tidy up.
-  p->chan = 0;
+  // wakeup() has taken us off the sleep queue.
 
   // Reacquire original lock.
-  if(lk != &ptable.lock){  //DOC: sleeplock2
-    release(&ptable.lock);
-    acquire(lk);
-  }
+  acquire(lk);  //DOC: sleeplock2
 }
 
 //PAGEBREAK!
 // Wake up all processes sleeping on chan.
-// The ptable lock must be held.
-static void
-wakeup1(void *chan)
+void
+wakeup(void *chan)
 {
-  struct proc *p;
-
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == SLEEPING && p->chan == chan)
-      p->state = RUNNABLE;
+  struct sleepq *sq = SLEEPQ(chan);
+  struct proc **pp, *p;
+
+  acquire(&sq->lock);
+  for(pp = &sq->head; (p = *pp) != 0; ){
+    if(p->chan == chan){
+      *pp = p->slnext;
+      p->chan = 0;
+      setrunnable(p);
+    } else
+      pp = &p->slnext;
+  }
+  release(&sq->lock);
 }
 
-// Wake up all processes sleeping on chan.
-void
-wakeup(void *chan)
+// Take p off its sleep queue and make it RUNNABLE, if it
+// is sleeping.  p->chan can change until we hold its sleep
+// queue lock, so check it again once we do.
+static void
+unsleep(struct proc *p)
 {
-  acquire(&ptable.lock);
-  wakeup1(chan);
-  release(&ptable.lock);
+  struct sleepq *sq;
+  struct proc **pp;
+  void *chan;
+
+  while((chan = p->chan) != 0){
+    sq = SLEEPQ(chan);
+    acquire(&sq->lock);
+    if(p->chan == chan){
+      for(pp = &sq->head; *pp != p; pp = &(*pp)->slnext)
+        ;
+      *pp = p->slnext;
+      p->chan = 0;
+      setrunnable(p);
+      release(&sq->lock);
+      return;
+    }
+    release(&sq->lock);
+  }
 }
 
 // Kill the process with the given pid.
@@ -570,15 +1467,12 @@ kill(int pid)
   struct proc *p;
 
   acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->pid == pid){
-      p->killed = 1;
-      // Wake process from sleep if necessary.
-      if(p->state == SLEEPING)
-        p->state = RUNNABLE;
-      release(&ptable.lock);
-      return 0;
-    }
+  if((p = findproc(pid)) != 0){
+    p->killed = 1;
+    // Wake process from sleep if necessary.
+    unsleep(p);
+    release(&ptable.lock);
+    return 0;
   }
   release(&ptable.lock);
   return -1;
@@ -601,8 +1495,9 @@ procdump(void)
   };
   int i;
   struct proc *p;
+  struct cpu *c;
   char *state;
-  uint pc[10];
+  uint pc[10], up;
 
   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
     if(p->state == UNUSED)
@@ -611,7 +1506,8 @@ procdump(void)
       state = states[p->state];
     else
       state = "???";
-    cprintf("%d %s %s", p->pid, state, p->name);
+    cprintf("%d %s %s L%d v%d i%d", p->pid, state, p->name, p->level,
+            p->nvol, p->ninvol);
     if(p->state == SLEEPING){
       getcallerpcs((uint*)p->context->ebp+2, pc);
       for(i=0; i<10 && pc[i] != 0; i++)
@@ -619,42 +1515,279 @@ procdump(void)
     }
     cprintf("\n");
   }
+  for(c = cpus; c < &cpus[ncpu]; c++){
+    // In millions of cycles, to stay within 32 bits.
+    up = (rdtsc() - c->tsc0) >> 20;
+    cprintf("cpu%d idle %d%% v%d i%d\n", c - cpus,
+            up ? (uint)(c->idlecycles >> 20) * 100 / up : 0,
+            c->nvol, c->ninvol);
+  }
+}
+
+// Report memory use: the physical and paging totals, and each
+// process's size, resident pages and swapped-out pages.
+void
+procmeminfo(struct meminfo *m)
+{
+  struct procmem *pm;
+  struct proc *p;
+
+  acquire(&ptable.lock);
+  m->swapped = 0;
+  m->nproc = 0;
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->state == UNUSED || p->state == EMBRYO || p->state == ZOMBIE)
+      continue;
+    pm = &m->proc[m->nproc++];
+    pm->pid = p->pid;
+    pm->sz = p->sz;
+    pm->rss = residentpages(p->pgdir);
+    pm->swapped = p->pageCtFile;
+    safestrcpy(pm->name, p->name, sizeof(pm->name));
+    m->swapped += p->pageCtFile;
+  }
+  release(&ptable.lock);
+}
+
+// Report scheduler statistics for each CPU and process.
+void
+procschedinfo(struct schedinfo *si)
+{
+  struct procsched *ps;
+  struct cpusched *cs;
+  struct proc *p;
+  struct cpu *c;
+  int i;
+
+  si->ncpu = ncpu;
+  for(c = cpus; c < &cpus[ncpu]; c++){
+    cs = &si->cpu[c - cpus];
+    cs->uptime = (rdtsc() - c->tsc0) >> 20;
+    cs->idle = c->idlecycles >> 20;
+    cs->nvol = c->nvol;
+    cs->ninvol = c->ninvol;
+    cs->ticks = c->count[CNT_TICKS];
+    cs->syscalls = c->count[CNT_SYSCALLS];
+    cs->faults = c->count[CNT_FAULTS];
+    for(i = 0; i < NLATBUCKET; i++)
+      cs->lat[i] = c->lat[i];
+  }
+
+  acquire(&ptable.lock);
+  si->nproc = 0;
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->state == UNUSED || p->state == EMBRYO)
+      continue;
+    ps = &si->proc[si->nproc++];
+    ps->pid = p->pid;
+    ps->cpu = p->cpu;
+    ps->nrun = p->nrun;
+    ps->wait = p->waitcycles >> 10;
+    ps->nvol = p->nvol;
+    ps->ninvol = p->ninvol;
+    safestrcpy(ps->name, p->name, sizeof(ps->name));
+  }
+  release(&ptable.lock);
+}
+
+// Point p's paging records at their storage in p and mark
+// them all free.
+static void
+pageinit(struct proc *p)
+{
+  int i;
+
+  for(i = 0; i < MAX_TOTAL_PAGES; i++){
+    p->pages[i] = &p->pagerec[i];
+    p->pagerec[i].address = 0;
+    p->pagerec[i].file_index = 0;
+    p->pagerec[i].swapped = -1;
+  }
+  memset(p->freeInFile, 0, sizeof(p->freeInFile));
+  p->pageCtTotal = 0;
+  p->pageCtFile = 0;
+  p->size = 0;
+#ifdef LRU
+  for(i = 0; i < 15; i++){
+    p->stack[i] = &p->nodes[i];
+    memset(p->stack[i], 0, sizeof(*p->stack[i]));
+  }
+  p->head = 0;
+  p->tail = 0;
+#endif
+}
+
+#ifdef LRU
+// Take n off p's LRU stack.
+static void
+lruunlink(struct proc *p, struct node *n)
+{
+  if(n->previousNode)
+    n->previousNode->nextNode = n->nextNode;
+  else if(p->head == n)
+    p->head = n->nextNode;
+  if(n->nextNode)
+    n->nextNode->previousNode = n->previousNode;
+  else if(p->tail == n)
+    p->tail = n->previousNode;
+  n->nextNode = 0;
+  n->previousNode = 0;
+  n->inuse = 0;
+}
+#endif
+
+// Forget the paging records of p's pages in [start, end),
+// which are being unmapped: free their swap file slots and
+// take them out of the replacement order.  The caller clears
+// the PTEs.  p is a leader; caller holds lockvm(p).
+void
+pagedrop(struct proc *p, uint start, uint end)
+{
+  struct page *pg;
+  int i, j;
+
+  for(i = 0; i < MAX_TOTAL_PAGES; i++){
+    pg = p->pages[i];
+    if(pg->swapped < 0 || pg->address < start || pg->address >= end)
+      continue;
+    if(pg->swapped){
+      p->freeInFile[pg->file_index] = 0;
+      p->pageCtFile--;
+    }
+#if defined(FIFO) || defined(RAND)
+    for(j = 0; j < p->size; j++){
+#ifdef FIFO
+      if(p->queue[j] != pg)
+        continue;
+      memmove(&p->queue[j], &p->queue[j+1], (p->size-j-1) * sizeof(p->queue[0]));
+#else
+      if(p->randpages[j] != pg)
+        continue;
+      p->randpages[j] = p->randpages[p->size-1];
+#endif
+      p->size--;
+      break;
+    }
+#endif
+#ifdef LRU
+    for(j = 0; j < 15; j++){
+      if(p->stack[j]->inuse && p->stack[j]->page == pg){
+        lruunlink(p, p->stack[j]);
+        p->size--;
+        break;
+      }
+    }
+#endif
+    p->pageCtTotal--;
+    pg->address = 0;
+    pg->file_index = 0;
+    pg->swapped = -1;
+  }
+}
+
+// Give np, a new child of leader p, copies of p's paging
+// records and swap file slots, to go with the page table
+// copyuvm() made.  Caller holds lockvm(p).
+// Returns 0, or -1 if out of memory.
+static int
+pagecopy(struct proc *np, struct proc *p)
+{
+  char *buf;
+  int i;
+
+  for(i = 0; i < MAX_TOTAL_PAGES; i++)
+    np->pagerec[i] = p->pagerec[i];
+  np->pageCtTotal = p->pageCtTotal;
+  np->pageCtFile = p->pageCtFile;
+  np->size = p->size;
+#ifdef FIFO
+  for(i = 0; i < p->size; i++)
+    np->queue[i] = &np->pagerec[p->queue[i] - p->pagerec];
+#endif
+#ifdef RAND
+  for(i = 0; i < p->size; i++)
+    np->randpages[i] = &np->pagerec[p->randpages[i] - p->pagerec];
+#endif
+#ifdef LRU
+  // The same nodes, linked the same way, in np.
+  for(i = 0; i < 15; i++){
+    np->nodes[i].inuse = p->nodes[i].inuse;
+    np->nodes[i].page = p->nodes[i].page ?
+      &np->pagerec[p->nodes[i].page - p->pagerec] : 0;
+    np->nodes[i].nextNode = p->nodes[i].nextNode ?
+      &np->nodes[p->nodes[i].nextNode - p->nodes] : 0;
+    np->nodes[i].previousNode = p->nodes[i].previousNode ?
+      &np->nodes[p->nodes[i].previousNode - p->nodes] : 0;
+  }
+  np->head = p->head ? &np->nodes[p->head - p->nodes] : 0;
+  np->tail = p->tail ? &np->nodes[p->tail - p->nodes] : 0;
+#endif
+
+  if(p->pageCtFile == 0)
+    return 0;
+  if((buf = kalloc()) == 0)
+    return -1;
+  for(i = 0; i < 15; i++){
+    np->freeInFile[i] = p->freeInFile[i];
+    if(!p->freeInFile[i])
+      continue;
+    readFromSwapFile(p, buf, i*PGSIZE, PGSIZE);
+    writeToSwapFile(np, buf, i*PGSIZE, PGSIZE);
+  }
+  kfree(buf);
+  return 0;
 }
 
 int swapIn(struct page *pg){//swaps INTO physical
+	struct proc *p = myproc()->leader;  //Threads page through their leader.
 	cprintf("[][][]swapping in][][][");
 	char * physMem = kalloc();
-	readFromSwapFile(myproc(), physMem, pg->file_index*4096,  4096);
-	myproc()->freeInFile[pg->file_index] = 0;
+	readFromSwapFile(p, physMem, pg->file_index*4096,  4096);
+	p->freeInFile[pg->file_index] = 0;
 	pg->swapped = 0;
 	pg->file_index = 0;
-	mappages((pde_t *)myproc()->pgdir, (char*) pg->address, 4096, V2P(physMem), PTE_W | PTE_U);
+	mappages((pde_t *)p->pgdir, (char*) pg->address, 4096, V2P(physMem), PTE_W | PTE_U);
+	cpucount(CNT_VMALLOCS, 1);
+	cpucount(CNT_SWAPINS, 1);
 	return 0;
 }
 
 int swapOut(struct page * pg)//swaps OUT of physical
 {
+	struct proc *p = myproc()->leader;  //Threads page through their leader.
+	struct tlbbatch tb;
 	cprintf("[][][]swapping out[][][]");
 	pte_t *victimAddress;
-	victimAddress = walkpgdir(myproc()->pgdir, (char*)pg->address, 0);
+	victimAddress = walkpgdir(p->pgdir, (char*)pg->address, 0);
+	if(*victimAddress & PTE_SHM)
+		panic("swapOut: shared page");
 	*victimAddress &= ~PTE_P;
 	*victimAddress |= PTE_PG;
+	//Shoot down before copying: a sibling thread on another CPU could
+	//otherwise keep writing through its stale TLB entry, and lose the write.
+	tb.pgdir = p->pgdir;
+	tb.n = 0;
+	tlbinval(&tb, pg->address);
+	tlbflush(&tb);
+	futexevict(PTE_ADDR(*victimAddress));  //Its sleepers' key is about to change.
 	//char * victimPA = (char *)PTE_ADDR(*victimAddress);
 	
 	int fileDest = 0;
 
 	for(fileDest = 0; fileDest < 15; fileDest ++)
 	{
-		if (myproc()->freeInFile[fileDest] == 0)//increment until an available page in the file is found
+		if (p->freeInFile[fileDest] == 0)//increment until an available page in the file is found
 		{
 			pg->file_index = fileDest;//mark the destination index of the file
 			pg->swapped = 1;
-			myproc()->freeInFile[fileDest] = 1;
-			writeToSwapFile(myproc(),(char*)(P2V(PTE_ADDR(*victimAddress))), fileDest*4096, 4096);//write the buffer into the file
-			myproc()->pageCtFile++;
+			p->freeInFile[fileDest] = 1;
+			writeToSwapFile(p,(char*)(P2V(PTE_ADDR(*victimAddress))), fileDest*4096, 4096);//write the buffer into the file
+			p->pageCtFile++;
+			cpucount(CNT_SWAPOUTS, 1);
 			break;
 		}
 	}
 
 	return 0;
 }
+
@@ -1,6 +1,18 @@
 
+// Per-CPU statistic counters, cpu->count[].  A CPU adds only
+// to its own (cpucount), and readers sum over CPUs (cpucounts).
+#define CNT_TICKS     0  // Timer interrupts taken while busy
+#define CNT_SYSCALLS  1  // System calls
+#define CNT_FAULTS    2  // Page faults
+#define CNT_VMALLOCS  3  // User pages allocated, eagerly or on a fault
+#define CNT_VMFREES   4  // User pages freed by deallocuvm and freevm
+#define CNT_SWAPINS   5  // Pages read back from swap files
+#define CNT_SWAPOUTS  6  // Pages written to swap files
+#define NCOUNT        7
+
 // Per-CPU state
 struct cpu {
+  struct cpu *self;            // At %gs:0; see mycpu()
   uchar apicid;                // Local APIC ID
   struct context *scheduler;   // swtch() here to enter scheduler
   struct taskstate ts;         // Used by x86 to find stack for interrupt
@@ -9,6 +21,17 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  pde_t *pgdir;                // Page table loaded in %cr3
+  volatile int idle;           // Halted in idle(); wake with T_WAKEUP
+  struct proc *migrate;        // Yielded here against its affinity mask
+  uint64 tsc0;                 // rdtsc() when scheduler() started
+  uint64 idlecycles;           // Cycles halted in idle()
+  uint nvol;                   // Switches away from a process that slept or exited
+  uint ninvol;                 // Switches away from a preempted process
+  uint lat[NLATBUCKET];        // Run queue waits of processes run here (schedinfo.h)
+  // On a line of their own, which also pads cpus[] so that no
+  // other CPU writes a line holding them.
+  uint count[NCOUNT] __attribute__((__aligned__(CACHELINE)));  // Statistic counters, by CNT_ above
 };
 
 extern struct cpu cpus[NCPU];
@@ -40,6 +63,25 @@ struct page {
   int swapped;        //1 if in file, 0 if in physical memory, -1 if uninitialized
 };
 
+// Virtual addresses whose PTEs in pgdir changed and must be
+// dropped from the TLBs of every CPU using pgdir (see tlbflush).
+struct tlbbatch {
+  pde_t *pgdir;
+  int n;
+  uint va[NTLBBATCH];
+};
+
+// Iterator over the PTEs of a user address range, one page
+// table at a time (see ptwalknext).
+struct ptwalk {
+  pde_t *pgdir;
+  uint va;            // Next address to visit
+  uint end;           // End of the range
+  uint base;          // Virtual address mapped by pte[0]
+  pte_t *pte;         // Run of PTEs in the current page table
+  int n;              // Number of entries in pte[]
+};
+
 #ifdef LRU
 struct node {
   struct node *nextNode;  //Node below in the stack.
@@ -49,6 +91,16 @@ struct node {
 };
 #endif
 
+// A memory-mapped file region (see mmap.c).
+struct vma {
+  uint start;         // First address, page-aligned
+  uint end;           // One past the last address, page-aligned
+  uint off;           // File offset mapped at start
+  int prot;           // PROT_READ, PROT_WRITE
+  int flags;          // MAP_SHARED or MAP_PRIVATE
+  struct file *f;     // Mapped file; 0 if the slot is free
+};
+
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -68,11 +120,37 @@ struct proc {
   char name[16];               // Process name (debugging)
   struct file *swapFile;       // Page/swap file.  Must initiate with createSwapFile.
   struct page *pages[MAX_TOTAL_PAGES];  //Pages within the process
+  struct page pagerec[MAX_TOTAL_PAGES];  //Storage behind pages[]; swapped is -1 if free
   int freeInFile[15];          //1 if page in file, 0 if free
   int SwapIndex;               //this SwapIndex int stores the file index last paged in, for removal
   int pageCtTotal;             //under our simple test paging strategy which will be lifo
   int pageCtFile;              //Number of pages in the swap file
   int size;
+  uint shmmask;                // Attached shared memory segments (bit per id)
+  struct vma vmas[NVMA];       // Memory-mapped files
+  int cpu;                     // CPU last run on; its run queue holds p
+  int level;                   // Scheduling priority level; 0 is highest
+  int qticks;                  // Timer ticks used at this level
+  int slice;                   // Timeslice in ticks (settimeslice)
+  uint affinity;               // CPUs p may run on, a bit per CPU
+  uint64 readyat;              // rdtsc() when p was last queued
+  uint64 waitcycles;           // Cycles spent queued
+  uint nrun;                   // Times scheduled
+  uint nvol;                   // Times it slept or exited
+  uint ninvol;                 // Times it was preempted
+  int tickets;                 // CPU share under the STRIDE scheduler
+  uint stride;                 // STRIDE1 / tickets
+  uint pass;                   // Virtual time; lowest pass runs next
+  struct proc *rqnext;         // Next on the run queue
+  struct proc *slnext;         // Next on the sleep queue
+  struct proc *pidnext;        // Next in the pid hash chain
+  struct proc *children;       // First child
+  struct proc *sibling;        // Next child of the same parent
+  struct proc *leader;         // Owns the address space; p itself unless a thread
+  int nthread;                 // Leader: threads sharing it, leader included
+  volatile uint vmbusy;        // Leader: address space locked (see lockvm)
+  int nshared;                 // Sleep locks held shared (holdingsleep_shared)
+  void *ustack;                // Thread: user stack passed to clone
   //Select which page replacement algorithm to use.
   #ifdef FIFO  //First in First Out
   struct page *queue[15];  //Queue of pages to swap out.
@@ -84,6 +162,7 @@ struct proc {
   struct node *stack[15];  //Array of nodes that represent a stack.
   struct node *head;  //Head of the linked list and the top of the stack.
   struct node *tail;  //Tail of the linked list and the bottom of the stack.
+  struct node nodes[15];  //Storage behind stack[].
   #endif
 };
 
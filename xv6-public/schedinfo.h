@@ -0,0 +1,35 @@
+// Scheduler statistics reported by the schedinfo system call.
+// Waits are in units of 1024 TSC cycles, and CPU times in units
+// of 2^20 cycles so that they last.  Include param.h first.
+//
+// lat[i] counts processes that waited on a run queue for
+// [2^i, 2^(i+1)) units before running; lat[0] also counts shorter
+// waits and lat[NLATBUCKET-1] all longer ones.
+
+struct cpusched {
+  uint uptime;       // Since this CPU started scheduling
+  uint idle;         // Halted with nothing to run
+  uint nvol;         // Switches away from a process that slept or exited
+  uint ninvol;       // Switches away from a preempted process
+  uint ticks;        // Timer interrupts taken while busy
+  uint syscalls;     // System calls made here
+  uint faults;       // Page faults taken here
+  uint lat[NLATBUCKET];
+};
+
+struct procsched {
+  int pid;
+  int cpu;           // CPU it last ran or is queued on
+  uint nrun;         // Times scheduled
+  uint wait;         // Time spent queued but not running
+  uint nvol;         // Times it slept or exited
+  uint ninvol;       // Times it was preempted
+  char name[16];
+};
+
+struct schedinfo {
+  int ncpu;
+  struct cpusched cpu[NCPU];
+  int nproc;         // Entries used in proc[]
+  struct procsched proc[NPROC];
+};
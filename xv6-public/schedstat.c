@@ -0,0 +1,50 @@
+// Print scheduler statistics: each CPU's idle share, context
+// switches, tick, system call and page fault counts and run
+// queue wait histogram, and each process's switches and time
+// spent waiting to run.
+// Waits are in units of 1024 TSC cycles.
+
+#include "types.h"
+#include "stat.h"
+#include "param.h"
+#include "schedinfo.h"
+#include "user.h"
+
+struct schedinfo si;
+
+int
+main(int argc, char *argv[])
+{
+  struct cpusched *cs;
+  struct procsched *ps;
+  uint n;
+  int i;
+
+  if(schedinfo(&si) < 0){
+    printf(2, "schedstat: schedinfo failed\n");
+    exit();
+  }
+
+  printf(1, "CPU\tIDLE%%\tVOL\tINVOL\tTICKS\tSYSCALL\tFAULTS\n");
+  for(cs = si.cpu; cs < &si.cpu[si.ncpu]; cs++)
+    printf(1, "%d\t%d\t%d\t%d\t%d\t%d\t%d\n", cs - si.cpu,
+           cs->uptime ? cs->idle / (cs->uptime/100 + 1) : 0,
+           cs->nvol, cs->ninvol, cs->ticks, cs->syscalls, cs->faults);
+
+  printf(1, "\nWAIT\tCOUNT\n");
+  for(i = 0; i < NLATBUCKET; i++){
+    n = 0;
+    for(cs = si.cpu; cs < &si.cpu[si.ncpu]; cs++)
+      n += cs->lat[i];
+    if(i < NLATBUCKET-1)
+      printf(1, "<%d\t%d\n", 1 << (i+1), n);
+    else
+      printf(1, ">=%d\t%d\n", 1 << i, n);
+  }
+
+  printf(1, "\nPID\tCPU\tRUNS\tWAIT\tVOL\tINVOL\tNAME\n");
+  for(ps = si.proc; ps < &si.proc[si.nproc]; ps++)
+    printf(1, "%d\t%d\t%d\t%d\t%d\t%d\t%s\n", ps->pid, ps->cpu, ps->nrun,
+           ps->wait, ps->nvol, ps->ninvol, ps->name);
+  exit();
+}
@@ -0,0 +1,253 @@
+// System V style shared memory segments.
+//
+// A segment is a set of physical pages held in shmtable.
+// shmat() maps them into the calling process at the segment's
+// own slot above SHMBASE, so a segment has the same address in
+// every process that attaches it.  kalloc's reference counts keep
+// each page alive while the table or any page table refers to it.
+//
+// Shared pages are marked PTE_SHM and never enter the paging
+// structures, so they are never swapped out.  fork() attaches
+// the child to all of its parent's segments; exec() and exit()
+// detach.  A segment is destroyed when its last process detaches.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+
+struct shmseg {
+  int key;
+  int ref;               // Number of attached processes
+  int npages;            // Size in pages; 0 if the slot is free
+  char *pages[SHMPAGES];
+};
+
+struct {
+  struct spinlock lock;
+  struct shmseg seg[NSHM];
+} shmtable;
+
+void
+shminit(void)
+{
+  initlock(&shmtable.lock, "shm");
+}
+
+// Address at which segment id is attached.
+static uint
+shmva(int id)
+{
+  return SHMBASE + id*SHMPAGES*PGSIZE;
+}
+
+// Map all of segment id into pgdir, taking a page reference
+// for each mapping.  On failure nothing is left mapped.  The
+// new PTEs were not present before, so there is nothing to
+// invalidate.  Caller must hold shmtable.lock.
+static int
+shmmap(pde_t *pgdir, int id)
+{
+  struct shmseg *s;
+  char *va;
+  int i;
+
+  s = &shmtable.seg[id];
+  for(i = 0; i < s->npages; i++){
+    va = (char*)shmva(id) + i*PGSIZE;
+    if(mappages(pgdir, va, PGSIZE, V2P(s->pages[i]), PTE_W|PTE_U|PTE_SHM) < 0){
+      while(--i >= 0){
+        *walkpgdir(pgdir, (char*)shmva(id) + i*PGSIZE, 0) = 0;
+        kfree(s->pages[i]);
+      }
+      return -1;
+    }
+    kref(s->pages[i]);
+  }
+  return 0;
+}
+
+// Drop p's attachment to segment id, destroying the segment
+// if p was the last process attached.  p's page table must
+// no longer map the segment.
+static void
+shmdrop(struct proc *p, int id)
+{
+  struct shmseg *s;
+  int i;
+
+  s = &shmtable.seg[id];
+  acquire(&shmtable.lock);
+  p->shmmask &= ~(1 << id);
+  if(--s->ref == 0){
+    for(i = 0; i < s->npages; i++)
+      kfree(s->pages[i]);
+    s->npages = 0;
+  }
+  release(&shmtable.lock);
+}
+
+// Unmap segment id from the current process and detach.
+static void
+shmunmap(int id)
+{
+  struct proc *curproc = myproc()->leader;
+  struct shmseg *s;
+  struct tlbbatch tb;
+  pte_t *pte;
+  uint va;
+  int i;
+
+  // The segment cannot go away while we are attached, and
+  // all of its pages are mapped, so its page list can be
+  // read without the lock.
+  s = &shmtable.seg[id];
+  tb.pgdir = curproc->pgdir;
+  tb.n = 0;
+  for(i = 0; i < s->npages; i++){
+    va = shmva(id) + i*PGSIZE;
+    if((pte = walkpgdir(curproc->pgdir, (char*)va, 0)) != 0 && (*pte & PTE_P)){
+      *pte = 0;
+      tlbinval(&tb, va);
+    }
+  }
+  tlbflush(&tb);
+  for(i = 0; i < s->npages; i++)
+    kfree(s->pages[i]);
+  shmdrop(curproc, id);
+}
+
+// Return the id of the segment with the given key, creating
+// it with size bytes of zeroed memory if it does not exist.
+// Returns -1 if the segment is too small or cannot be created.
+int
+shmget(int key, uint size)
+{
+  struct shmseg *s, *fs;
+  int i, n;
+
+  n = PGROUNDUP(size) / PGSIZE;
+  if(n > SHMPAGES)
+    return -1;
+
+  acquire(&shmtable.lock);
+  fs = 0;
+  for(s = shmtable.seg; s < &shmtable.seg[NSHM]; s++){
+    if(s->npages && s->key == key){
+      release(&shmtable.lock);
+      if(n > s->npages)
+        return -1;
+      return s - shmtable.seg;
+    }
+    if(s->npages == 0 && fs == 0)
+      fs = s;
+  }
+  if(fs == 0 || n == 0){
+    release(&shmtable.lock);
+    return -1;
+  }
+
+  for(i = 0; i < n; i++){
+    if((fs->pages[i] = kalloc()) == 0){
+      while(--i >= 0)
+        kfree(fs->pages[i]);
+      release(&shmtable.lock);
+      return -1;
+    }
+    memset(fs->pages[i], 0, PGSIZE);
+  }
+  fs->key = key;
+  fs->ref = 0;
+  fs->npages = n;
+  release(&shmtable.lock);
+  return fs - shmtable.seg;
+}
+
+// Attach segment id to the current process.
+// Returns the address it is mapped at, or -1.
+int
+shmat(int id)
+{
+  struct proc *curproc = myproc()->leader;
+
+  if(id < 0 || id >= NSHM)
+    return -1;
+
+  acquire(&shmtable.lock);
+  if(shmtable.seg[id].npages == 0 || (curproc->shmmask & (1 << id))){
+    release(&shmtable.lock);
+    return -1;
+  }
+  if(shmmap(curproc->pgdir, id) < 0){
+    release(&shmtable.lock);
+    return -1;
+  }
+  shmtable.seg[id].ref++;
+  curproc->shmmask |= 1 << id;
+  release(&shmtable.lock);
+  return shmva(id);
+}
+
+// Detach the segment attached at addr from the current process.
+int
+shmdt(uint addr)
+{
+  int id;
+
+  if(addr < SHMBASE || (addr - SHMBASE) % (SHMPAGES*PGSIZE) != 0)
+    return -1;
+  id = (addr - SHMBASE) / (SHMPAGES*PGSIZE);
+  if(id >= NSHM || (myproc()->leader->shmmask & (1 << id)) == 0)
+    return -1;
+  shmunmap(id);
+  return 0;
+}
+
+// Attach np to every segment p is attached to.
+// On failure np may be attached to some of them; the
+// caller cleans up with freevm(np->pgdir) and shmexec(np).
+int
+shmfork(struct proc *np, struct proc *p)
+{
+  int id;
+
+  acquire(&shmtable.lock);
+  for(id = 0; id < NSHM; id++){
+    if((p->shmmask & (1 << id)) == 0)
+      continue;
+    if(shmmap(np->pgdir, id) < 0){
+      release(&shmtable.lock);
+      return -1;
+    }
+    shmtable.seg[id].ref++;
+    np->shmmask |= 1 << id;
+  }
+  release(&shmtable.lock);
+  return 0;
+}
+
+// Detach the current process from all of its segments.
+void
+shmexit(void)
+{
+  int id;
+
+  for(id = 0; id < NSHM; id++)
+    if(myproc()->leader->shmmask & (1 << id))
+      shmunmap(id);
+}
+
+// Detach p from all of its segments once the page table
+// that mapped them has been freed (by exec or a failed fork).
+void
+shmexec(struct proc *p)
+{
+  int id;
+
+  for(id = 0; id < NSHM; id++)
+    if(p->shmmask & (1 << id))
+      shmdrop(p, id);
+}
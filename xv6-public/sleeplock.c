@@ -14,40 +14,126 @@ void
 initsleeplock(struct sleeplock *lk, char *name)
 {
   initlock(&lk->lk, "sleep lock");
+  lk->class = lockclass(name, 1);
+  lk->tsc = 0;
   lk->name = name;
   lk->locked = 0;
+  lk->readers = 0;
+  lk->writers = 0;
   lk->pid = 0;
+  lk->owner = 0;
+}
+
+// A lock held by a process running on another CPU is likely
+// to be released soon, so spin while that lasts, for up to
+// *budget loops in all, instead of paying for a sleep and a
+// wakeup.  Returns 1 if it spun; 0 means the caller should
+// sleep.  Called and returns with lk->lk held.
+static int
+spinwait(struct sleeplock *lk, int *budget)
+{
+  struct proc *p;
+
+  p = lk->owner;
+  if(*budget <= 0 || !lk->locked || p == 0 || p->state != RUNNING)
+    return 0;
+  release(&lk->lk);
+  // Racy peeks, but each only decides how long to spin.
+  while(*budget > 0 && lk->locked && lk->owner == p && p->state == RUNNING){
+    pause();
+    (*budget)--;
+  }
+  acquire(&lk->lk);
+  return 1;
 }
 
 void
 acquiresleep(struct sleeplock *lk)
 {
+  uint64 t0;
+  int contended, budget;
+
   acquire(&lk->lk);
-  while (lk->locked) {
-    sleep(lk, &lk->lk);
+  t0 = rdtsc();
+  contended = lk->locked || lk->readers;
+  budget = SLEEPSPIN;
+  lk->writers++;
+  while (lk->locked || lk->readers) {
+    if(!spinwait(lk, &budget))
+      sleep(lk, &lk->lk);
   }
+  lk->writers--;
   lk->locked = 1;
   lk->pid = myproc()->pid;
+  lk->owner = myproc();
+  lk->tsc = lockacquired(lk->class, contended, t0);
+  release(&lk->lk);
+}
+
+// Acquire lk shared with other readers.  Waits while it is held
+// exclusively or a writer is waiting, so writers do not starve.
+void
+acquiresleep_shared(struct sleeplock *lk)
+{
+  uint64 t0;
+  int contended, budget;
+
+  acquire(&lk->lk);
+  t0 = rdtsc();
+  contended = lk->locked || lk->writers;
+  budget = SLEEPSPIN;
+  while (lk->locked || lk->writers) {
+    if(!spinwait(lk, &budget))
+      sleep(lk, &lk->lk);
+  }
+  lk->readers++;
+  myproc()->nshared++;
+  // Hold time is only counted for exclusive holders.
+  lockacquired(lk->class, contended, t0);
   release(&lk->lk);
 }
 
+// Release lk, held either exclusively or shared.
 void
 releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
-  lk->locked = 0;
-  lk->pid = 0;
-  wakeup(lk);
+  if(lk->locked){
+    lockreleased(lk->class, lk->tsc);
+    lk->locked = 0;
+    lk->pid = 0;
+    lk->owner = 0;
+    wakeup(lk);
+  } else {
+    myproc()->nshared--;
+    if(--lk->readers == 0)
+      wakeup(lk);
+  }
   release(&lk->lk);
 }
 
+// Does this process hold lk exclusively?
 int
 holdingsleep(struct sleeplock *lk)
 {
   int r;
   
   acquire(&lk->lk);
-  r = lk->locked;
+  r = lk->locked && lk->owner == myproc();
+  release(&lk->lk);
+  return r;
+}
+
+// Might this process hold lk shared?  Readers are only
+// counted, so this checks that lk has some and that we hold
+// some sleep lock shared.
+int
+holdingsleep_shared(struct sleeplock *lk)
+{
+  int r;
+
+  acquire(&lk->lk);
+  r = !lk->locked && lk->readers > 0 && myproc()->nshared > 0;
   release(&lk->lk);
   return r;
 }
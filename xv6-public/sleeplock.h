@@ -1,10 +1,18 @@
 // Long-term locks for processes
+// Held either exclusively (locked) or shared by readers.
+// Waiters spin briefly while the exclusive owner is running,
+// and sleep otherwise.
 struct sleeplock {
-  uint locked;       // Is the lock held?
+  uint locked;       // Is the lock held exclusively?
+  int readers;       // Number of shared holders
+  int writers;       // Exclusive acquirers waiting; hold off new readers
   struct spinlock lk; // spinlock protecting this sleep lock
+  struct lockclass *class;  // Contention counters, or 0 if none
+  uint64 tsc;        // rdtsc() when acquired
   
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
+  struct proc *owner;  // Process holding lock exclusively
 };
 
@@ -8,29 +8,132 @@
 #include "mmu.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "lockstat.h"
+
+// MCS queue locks.  Waiters form a queue through per-CPU nodes,
+// and each spins on its own node's cache line until the holder
+// hands the lock on, so a handoff invalidates only that line.
+// Every lock has a node per CPU; a CPU never waits for the same
+// lock twice at once, and a lock is released on the CPU that
+// acquired it.
+struct mcsnode {
+  struct mcsnode *volatile next;  // Next waiter in the queue
+  volatile uint wait;             // Spin while set
+} __attribute__((aligned(64)));
+
+struct mcslock {
+  struct mcsnode *volatile tail;  // Last waiter, or holder if none
+  struct mcsnode node[NCPU];
+};
+
+static struct mcslock mcslocks[NMCSLOCK];
+static uint nmcslock;
+
+// Contention counters for lockstat.  Locks with the same name
+// (every "inode" sleeplock, say) share a class, so locks in
+// memory that is freed, like a pipe's, need not be unregistered.
+// Each CPU updates only its own counters, with interrupts off.
+struct lockcounts {
+  uint nacquire;
+  uint ncontended;     // Acquisitions that had to wait
+  uint64 wait;         // Cycles spent waiting
+  uint64 hold;         // Cycles held
+};
+
+struct lockclass {
+  char name[16];
+  int sleep;           // Sleeplocks, not spinlocks
+  struct lockcounts cpu[NCPU];
+};
+
+static struct lockclass lockclasses[NLOCKCLASS];
+static int nlockclass;
+static uint classlock;  // Not a spinlock: initlock() runs before seginit()
 
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
-  lk->locked = 0;
+  lk->next = 0;
+  lk->owner = 0;
+  lk->mcs = 0;
+  lk->class = lockclass(name, 0);
+  lk->tsc = 0;
   lk->cpu = 0;
 }
 
+// Initialize lk as an MCS queue lock, for heavily contended
+// locks.  Otherwise it behaves just like initlock().
+void
+initmcslock(struct spinlock *lk, char *name)
+{
+  initlock(lk, name);
+  if(nmcslock >= NMCSLOCK)
+    panic("initmcslock");
+  lk->mcs = &mcslocks[nmcslock++];
+}
+
+// Returns 1 if it had to wait.
+static int
+mcsacquire(struct mcslock *m)
+{
+  struct mcsnode *n, *prev;
+
+  n = &m->node[cpuid()];
+  n->next = 0;
+  n->wait = 1;
+  // The xchg is atomic; it queues n behind the old tail.
+  prev = (struct mcsnode*)xchg((volatile uint*)&m->tail, (uint)n);
+  if(prev == 0)
+    return 0;
+  prev->next = n;
+  while(n->wait)
+    pause();
+  return 1;
+}
+
+static void
+mcsrelease(struct mcslock *m)
+{
+  struct mcsnode *n;
+
+  n = &m->node[cpuid()];
+  if(n->next == 0){
+    // No known waiter: empty the queue unless one just joined.
+    if(__sync_bool_compare_and_swap(&m->tail, n, 0))
+      return;
+    while(n->next == 0)
+      pause();
+  }
+  n->next->wait = 0;
+}
+
 // Acquire the lock.
 // Loops (spins) until the lock is acquired.
+// Waiters are served first come, first served.
 // Holding a lock for a long time may cause
 // other CPUs to waste time spinning to acquire it.
 void
 acquire(struct spinlock *lk)
 {
+  uint ticket;
+  uint64 t0;
+  int contended;
+
   pushcli(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
-  // The xchg is atomic.
-  while(xchg(&lk->locked, 1) != 0)
-    ;
+  t0 = rdtsc();
+  if(lk->mcs)
+    contended = mcsacquire(lk->mcs);
+  else {
+    // The xadd is atomic, so each CPU gets its own ticket.
+    ticket = xadd(&lk->next, 1);
+    contended = lk->owner != ticket;
+    while(lk->owner != ticket)
+      pause();
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,6 +143,7 @@ acquire(struct spinlock *lk)
   // Record info about lock acquisition for debugging.
   lk->cpu = mycpu();
   getcallerpcs(&lk, lk->pcs);
+  lk->tsc = lockacquired(lk->class, contended, t0);
 }
 
 // Release the lock.
@@ -49,6 +153,7 @@ release(struct spinlock *lk)
   if(!holding(lk))
     panic("release");
 
+  lockreleased(lk->class, lk->tsc);
   lk->pcs[0] = 0;
   lk->cpu = 0;
 
@@ -59,14 +164,108 @@ release(struct spinlock *lk)
   // stores; __sync_synchronize() tells them both not to.
   __sync_synchronize();
 
-  // Release the lock, equivalent to lk->locked = 0.
-  // This code can't use a C assignment, since it might
-  // not be atomic. A real OS would use C atomics here.
-  asm volatile("movl $0, %0" : "+m" (lk->locked) : );
+  // Pass the lock to the next ticket, equivalent to lk->owner++.
+  // Only the holder writes owner, so a plain store will do,
+  // but it can't be a C assignment, since it might not be
+  // atomic. A real OS would use C atomics here.
+  if(lk->mcs)
+    mcsrelease(lk->mcs);
+  else
+    asm volatile("movl %1, %0" : "+m" (lk->owner) : "r" (lk->owner + 1));
 
   popcli();
 }
 
+// Return the class for locks named name, adding it if need be,
+// or 0 if there are too many classes to count it.
+struct lockclass*
+lockclass(char *name, int sleep)
+{
+  struct lockclass *c;
+  uint eflags;
+
+  eflags = readeflags();
+  cli();
+  while(xchg(&classlock, 1) != 0)
+    pause();
+  for(c = lockclasses; c < &lockclasses[nlockclass]; c++)
+    if(c->sleep == sleep && strncmp(c->name, name, sizeof(c->name)) == 0)
+      break;
+  if(c == &lockclasses[nlockclass]){
+    if(nlockclass < NLOCKCLASS){
+      safestrcpy(c->name, name, sizeof(c->name));
+      c->sleep = sleep;
+      nlockclass++;
+    } else
+      c = 0;
+  }
+  xchg(&classlock, 0);
+  if(eflags & FL_IF)
+    sti();
+  return c;
+}
+
+// Count an acquisition of a lock in class c that started
+// waiting at t0.  Returns the time it was acquired.
+// Interrupts must be off.
+uint64
+lockacquired(struct lockclass *c, int contended, uint64 t0)
+{
+  struct lockcounts *lc;
+  uint64 now;
+
+  now = rdtsc();
+  if(c == 0)
+    return now;
+  lc = &c->cpu[cpuid()];
+  lc->nacquire++;
+  if(contended){
+    lc->ncontended++;
+    lc->wait += now - t0;
+  }
+  return now;
+}
+
+// Count the time a lock in class c was held, since t.
+// Interrupts must be off.
+void
+lockreleased(struct lockclass *c, uint64 t)
+{
+  if(c)
+    c->cpu[cpuid()].hold += rdtsc() - t;
+}
+
+// Report the counters of every lock class, summed over CPUs,
+// and zero them if reset is set.
+void
+getlockstat(struct lockstat *ls, int reset)
+{
+  struct lockclass *c;
+  struct lockcounts *lc;
+  struct lockinfo *li;
+  uint64 wait, hold;
+
+  ls->n = 0;
+  for(c = lockclasses; c < &lockclasses[nlockclass]; c++){
+    li = &ls->lock[ls->n++];
+    safestrcpy(li->name, c->name, sizeof(li->name));
+    li->sleep = c->sleep;
+    li->nacquire = 0;
+    li->ncontended = 0;
+    wait = hold = 0;
+    for(lc = c->cpu; lc < &c->cpu[ncpu]; lc++){
+      li->nacquire += lc->nacquire;
+      li->ncontended += lc->ncontended;
+      wait += lc->wait;
+      hold += lc->hold;
+    }
+    li->wait = wait >> 10;
+    li->hold = hold >> 10;
+    if(reset)
+      memset(c->cpu, 0, sizeof(c->cpu));
+  }
+}
+
 // Record the current call stack in pcs[] by following the %ebp chain.
 void
 getcallerpcs(void *v, uint pcs[])
@@ -89,7 +288,9 @@ getcallerpcs(void *v, uint pcs[])
 int
 holding(struct spinlock *lock)
 {
-  return lock->locked && lock->cpu == mycpu();
+  if(lock->mcs)
+    return lock->mcs->tail != 0 && lock->cpu == mycpu();
+  return lock->owner != lock->next && lock->cpu == mycpu();
 }
 
 
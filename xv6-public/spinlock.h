@@ -1,6 +1,15 @@
 // Mutual exclusion lock.
+// A ticket lock: acquire() takes the next ticket and waits for
+// owner to reach it, so CPUs get the lock in the order they ask.
+// The lock is held while owner != next.
+// A lock set up by initmcslock() is an MCS queue lock instead;
+// see spinlock.c.
 struct spinlock {
-  uint locked;       // Is the lock held?
+  volatile uint next;   // Next ticket to hand out
+  volatile uint owner;  // Ticket now allowed to hold the lock
+  struct mcslock *mcs;  // Queue lock state, or 0 for a ticket lock
+  struct lockclass *class;  // Contention counters, or 0 if none
+  uint64 tsc;           // rdtsc() when acquired
 
   // For debugging:
   char *name;        // Name of lock.
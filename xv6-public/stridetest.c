@@ -0,0 +1,96 @@
+// Show CPU shares converging to ticket ratios under the stride
+// scheduler.  Build with SCHEDULER = STRIDE; the shares are per
+// CPU, so run with CPUS = 1.
+//
+// Each child takes a different number of tickets and counts loop
+// iterations, reporting its count after every PERIOD ticks.  The
+// parent prints each child's share of the total at each report.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NCHILD 3
+#define NREPORT 5
+#define PERIOD 100  // ticks between reports
+
+int tickets[NCHILD] = { 100, 200, 300 };
+uint counts[NREPORT][NCHILD];
+
+struct report {
+  int child;
+  int n;
+  uint count;
+};
+
+void
+child(int i, int start, int fd)
+{
+  struct report r;
+  uint count;
+  int n;
+
+  settickets(tickets[i]);
+  while(uptime() < start)
+    ;
+  count = 0;
+  for(n = 0; n < NREPORT; n++){
+    while(uptime() < start + (n+1)*PERIOD)
+      count++;
+    r.child = i;
+    r.n = n;
+    r.count = count;
+    write(fd, &r, sizeof(r));
+  }
+  exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct report r;
+  int fds[2], i, n, start;
+  uint total;
+
+#ifndef STRIDE
+  printf(1, "stridetest: kernel not built with SCHEDULER = STRIDE\n");
+#endif
+  if(pipe(fds) < 0){
+    printf(2, "stridetest: pipe failed\n");
+    exit();
+  }
+  // Start together, once all children exist.
+  start = uptime() + 10;
+  for(i = 0; i < NCHILD; i++){
+    n = fork();
+    if(n < 0){
+      printf(2, "stridetest: fork failed\n");
+      exit();
+    }
+    if(n == 0){
+      close(fds[0]);
+      child(i, start, fds[1]);
+    }
+  }
+  close(fds[1]);
+
+  while(read(fds[0], &r, sizeof(r)) == sizeof(r))
+    counts[r.n][r.child] = r.count;
+  for(i = 0; i < NCHILD; i++)
+    wait();
+
+  printf(1, "ticks");
+  for(i = 0; i < NCHILD; i++)
+    printf(1, "\t%d tix", tickets[i]);
+  printf(1, "\n");
+  for(n = 0; n < NREPORT; n++){
+    total = 0;
+    for(i = 0; i < NCHILD; i++)
+      total += counts[n][i];
+    printf(1, "%d", (n+1)*PERIOD);
+    for(i = 0; i < NCHILD; i++)
+      printf(1, "\t%d%%", total ? counts[n][i] / (total/100 + 1) : 0);
+    printf(1, "\n");
+  }
+  exit();
+}
@@ -103,6 +103,22 @@ extern int sys_unlink(void);
 extern int sys_wait(void);
 extern int sys_write(void);
 extern int sys_uptime(void);
+extern int sys_shmget(void);
+extern int sys_shmat(void);
+extern int sys_shmdt(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_meminfo(void);
+extern int sys_getlevel(void);
+extern int sys_settickets(void);
+extern int sys_clone(void);
+extern int sys_join(void);
+extern int sys_futex_wait(void);
+extern int sys_futex_wake(void);
+extern int sys_settimeslice(void);
+extern int sys_setaffinity(void);
+extern int sys_schedinfo(void);
+extern int sys_lockstat(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -126,6 +142,22 @@ static int (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_shmget]  sys_shmget,
+[SYS_shmat]   sys_shmat,
+[SYS_shmdt]   sys_shmdt,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_meminfo] sys_meminfo,
+[SYS_getlevel] sys_getlevel,
+[SYS_settickets] sys_settickets,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_futex_wait] sys_futex_wait,
+[SYS_futex_wake] sys_futex_wake,
+[SYS_settimeslice] sys_settimeslice,
+[SYS_setaffinity] sys_setaffinity,
+[SYS_schedinfo] sys_schedinfo,
+[SYS_lockstat] sys_lockstat,
 };
 
 void
@@ -134,6 +166,7 @@ syscall(void)
   int num;
   struct proc *curproc = myproc();
 
+  cpucount(CNT_SYSCALLS, 1);
   num = curproc->tf->eax;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
     curproc->tf->eax = syscalls[num]();
@@ -20,3 +20,19 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_shmget 22
+#define SYS_shmat  23
+#define SYS_shmdt  24
+#define SYS_mmap   25
+#define SYS_munmap 26
+#define SYS_meminfo 27
+#define SYS_getlevel 28
+#define SYS_settickets 29
+#define SYS_clone  30
+#define SYS_join   31
+#define SYS_futex_wait 32
+#define SYS_futex_wake 33
+#define SYS_settimeslice 34
+#define SYS_setaffinity 35
+#define SYS_schedinfo 36
+#define SYS_lockstat 37
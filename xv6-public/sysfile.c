@@ -420,6 +420,36 @@ sys_exec(void)
   return exec(path, argv);
 }
 
+int
+sys_mmap(void)
+{
+  struct file *f;
+  int off, len, prot, flags, addr;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &off) < 0 || argint(2, &len) < 0 ||
+     argint(3, &prot) < 0 || argint(4, &flags) < 0)
+    return -1;
+  if(off < 0 || len <= 0)
+    return -1;
+  lockvm(myproc());
+  addr = mmap(f, off, len, prot, flags);
+  unlockvm(myproc());
+  return addr;
+}
+
+int
+sys_munmap(void)
+{
+  int addr, len, r;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || len <= 0)
+    return -1;
+  lockvm(myproc());
+  r = munmap(addr, len);
+  unlockvm(myproc());
+  return r;
+}
+
 int
 sys_pipe(void)
 {
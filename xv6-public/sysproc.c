@@ -6,6 +6,10 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "meminfo.h"
+#include "schedinfo.h"
+#include "lockstat.h"
+#include "timer.h"
 
 int
 sys_fork(void)
@@ -50,8 +54,8 @@ sys_sbrk(void)
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
-  myproc()->sz = myproc()->sz + n;
+  if((addr = growproc(n)) < 0)
+    return -1;
   return addr;
 }
 
@@ -59,32 +63,197 @@ int
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
+  struct timer t;
 
   if(argint(0, &n) < 0)
     return -1;
+  if(n <= 0)
+    return 0;
   acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
+  t.expires = ticks + n;
+  timeradd(&t);
+  while(t.pprev){
     if(myproc()->killed){
+      timerdel(&t);
       release(&tickslock);
       return -1;
     }
-    sleep(&ticks, &tickslock);
+    sleep(&t, &tickslock);
   }
   release(&tickslock);
   return 0;
 }
 
+int
+sys_shmget(void)
+{
+  int key, size;
+
+  if(argint(0, &key) < 0 || argint(1, &size) < 0)
+    return -1;
+  return shmget(key, size);
+}
+
+int
+sys_shmat(void)
+{
+  int id, addr;
+
+  if(argint(0, &id) < 0)
+    return -1;
+  lockvm(myproc());
+  addr = shmat(id);
+  unlockvm(myproc());
+  return addr;
+}
+
+int
+sys_shmdt(void)
+{
+  int addr, r;
+
+  if(argint(0, &addr) < 0)
+    return -1;
+  lockvm(myproc());
+  r = shmdt(addr);
+  unlockvm(myproc());
+  return r;
+}
+
+int
+sys_meminfo(void)
+{
+  struct meminfo *m, *km;
+
+  if(argptr(0, (void*)&m, sizeof(*m)) < 0)
+    return -1;
+  // Gather into kernel memory: a fault on m while holding
+  // ptable.lock would need that lock in lockvm().
+  if((km = (struct meminfo*)kalloc()) == 0)
+    return -1;
+  kmeminfo(km);
+  vmmeminfo(km);
+  procmeminfo(km);
+  // With no locks held, a fault on m can bring its pages in.
+  memmove(m, km, sizeof(*m));
+  kfree((char*)km);
+  return 0;
+}
+
+int
+sys_getlevel(void)
+{
+  int pid;
+
+  if(argint(0, &pid) < 0)
+    return -1;
+  return getlevel(pid);
+}
+
+int
+sys_settickets(void)
+{
+  int n;
+
+  if(argint(0, &n) < 0)
+    return -1;
+  return settickets(n);
+}
+
+int
+sys_settimeslice(void)
+{
+  int n;
+
+  if(argint(0, &n) < 0)
+    return -1;
+  return settimeslice(n);
+}
+
+int
+sys_setaffinity(void)
+{
+  int pid, mask;
+
+  if(argint(0, &pid) < 0 || argint(1, &mask) < 0)
+    return -1;
+  return setaffinity(pid, mask);
+}
+
+int
+sys_schedinfo(void)
+{
+  struct schedinfo *si, *ksi;
+
+  if(argptr(0, (void*)&si, sizeof(*si)) < 0)
+    return -1;
+  // As in sys_meminfo(), copy out only once no locks are held.
+  if((ksi = (struct schedinfo*)kalloc()) == 0)
+    return -1;
+  procschedinfo(ksi);
+  memmove(si, ksi, sizeof(*si));
+  kfree((char*)ksi);
+  return 0;
+}
+
+int
+sys_lockstat(void)
+{
+  struct lockstat *ls;
+  int reset;
+
+  if(argptr(0, (void*)&ls, sizeof(*ls)) < 0 || argint(1, &reset) < 0)
+    return -1;
+  getlockstat(ls, reset);
+  return 0;
+}
+
+int
+sys_clone(void)
+{
+  int fn, arg;
+  char *stack;
+
+  if(argint(0, &fn) < 0 || argint(1, &arg) < 0 ||
+     argptr(2, &stack, PGSIZE) < 0)
+    return -1;
+  return clone((void(*)(void*))fn, (void*)arg, stack);
+}
+
+int
+sys_join(void)
+{
+  void **stack;
+
+  if(argptr(0, (void*)&stack, sizeof(*stack)) < 0)
+    return -1;
+  return join(stack);
+}
+
+int
+sys_futex_wait(void)
+{
+  int addr, val;
+
+  if(argint(0, &addr) < 0 || argint(1, &val) < 0)
+    return -1;
+  return futexwait(addr, val);
+}
+
+int
+sys_futex_wake(void)
+{
+  int addr, n;
+
+  if(argint(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  return futexwake(addr, n);
+}
+
 // return how many clock tick interrupts have occurred
-// since start.
+// since start.  Reading the aligned word needs no tickslock.
 int
 sys_uptime(void)
 {
-  uint xticks;
-
-  acquire(&tickslock);
-  xticks = ticks;
-  release(&tickslock);
-  return xticks;
+  return ticks;
 }
@@ -0,0 +1,142 @@
+// Hierarchical timer wheel.
+//
+// Pending timers hang off NWHEEL wheels of WHEELSIZE slots.  A timer
+// due within WHEELSIZE ticks sits in wheel 0 in the slot for its
+// exact tick; one due within WHEELSIZE^2 ticks sits in wheel 1 in
+// the slot for its tick divided by WHEELSIZE, and so on.  Each tick
+// runs only wheel 0's current slot.  When wheel 0 wraps, the next
+// slot of wheel 1 is cascaded: its timers are added again, which
+// moves them down a wheel.  Adding, removing and expiring a timer
+// cost O(1), and ticks with nothing due do almost no work.
+//
+// Timers are driven by trap.c's timer interrupt on CPU 0, and all
+// of this is protected by tickslock.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "timer.h"
+
+#define WHEELBITS 6
+#define WHEELSIZE (1 << WHEELBITS)
+#define WHEELMASK (WHEELSIZE - 1)
+#define NWHEEL 3
+
+struct {
+  struct timer *slot[NWHEEL][WHEELSIZE];
+  uint now;                 // Last tick whose timers have run
+} wheel;
+
+// Put t in the slot for its expiry time.
+static void
+place(struct timer *t)
+{
+  struct timer **slot;
+  uint delta, when;
+  int i;
+
+  // A timer cascaded on its own tick goes in the slot
+  // about to run.
+  delta = t->expires - wheel.now;
+  if((int)delta < 0)
+    delta = 0;
+  when = wheel.now + delta;
+  // Timers beyond the last wheel wait in its farthest slot
+  // and are placed again when it cascades.
+  if(delta >= 1 << (WHEELBITS*NWHEEL))
+    when = wheel.now + (1 << (WHEELBITS*NWHEEL)) - 1;
+  for(i = 0; i < NWHEEL-1; i++)
+    if(when - wheel.now < 1 << (WHEELBITS*(i+1)))
+      break;
+  slot = &wheel.slot[i][(when >> (WHEELBITS*i)) & WHEELMASK];
+  t->next = *slot;
+  if(t->next)
+    t->next->pprev = &t->next;
+  t->pprev = slot;
+  *slot = t;
+}
+
+// Start t, which must not be pending.  It fires on the
+// tick at which ticks reaches t->expires, or on the next
+// tick if that has passed.  Caller must hold tickslock.
+void
+timeradd(struct timer *t)
+{
+  if(!holding(&tickslock))
+    panic("timeradd");
+  if((int)(t->expires - wheel.now) <= 0)
+    t->expires = wheel.now + 1;
+  place(t);
+}
+
+// Stop t if it is pending.  Caller must hold tickslock.
+void
+timerdel(struct timer *t)
+{
+  if(t->pprev == 0)
+    return;
+  *t->pprev = t->next;
+  if(t->next)
+    t->next->pprev = t->pprev;
+  t->pprev = 0;
+}
+
+// Move the timers of slot s of wheel i to lower wheels.
+static void
+cascade(int i, int s)
+{
+  struct timer *t, *next;
+
+  t = wheel.slot[i][s];
+  wheel.slot[i][s] = 0;
+  for(; t; t = next){
+    next = t->next;
+    place(t);
+  }
+}
+
+// Run the timers due at ticks, waking whoever sleeps on
+// each.  Called on every tick with tickslock held.
+void
+timertick(void)
+{
+  struct timer *t;
+  int i;
+
+  while(wheel.now != ticks){
+    wheel.now++;
+    for(i = 1; i < NWHEEL; i++){
+      if((wheel.now >> (WHEELBITS*(i-1))) & WHEELMASK)
+        break;
+    }
+    // Wheels 1..i-1 just wrapped; cascade from the top.
+    while(--i >= 1)
+      cascade(i, (wheel.now >> (WHEELBITS*i)) & WHEELMASK);
+
+    while((t = wheel.slot[0][wheel.now & WHEELMASK]) != 0){
+      timerdel(t);
+      wakeup(t);
+    }
+  }
+}
+
+// Return the number of ticks until the next tick that has
+// work to do, or 0 if no timer is pending.  A timer in a
+// higher wheel counts as due when wheel 0 next wraps, since
+// that is when it cascades.  Caller must hold tickslock.
+uint
+timernext(void)
+{
+  uint d;
+  int i, s;
+
+  for(d = 1; d < WHEELSIZE; d++)
+    if(wheel.slot[0][(wheel.now + d) & WHEELMASK])
+      return d;
+  for(i = 1; i < NWHEEL; i++)
+    for(s = 0; s < WHEELSIZE; s++)
+      if(wheel.slot[i][s])
+        return WHEELSIZE - (wheel.now & WHEELMASK);
+  return 0;
+}
@@ -0,0 +1,6 @@
+// A one-shot timer on the timer wheel (see timer.c).
+struct timer {
+  uint expires;          // Value of ticks at which it fires
+  struct timer *next;    // Wheel slot list
+  struct timer **pprev;  // Link pointing at this timer; 0 if not pending
+};
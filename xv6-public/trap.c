@@ -61,11 +61,17 @@ trap(struct trapframe *tf)
 
   switch(tf->trapno){
   case T_IRQ0 + IRQ_TIMER:
-    if(cpuid() == 0){
+    cpucount(CNT_TICKS, 1);
+    // While CPU 0 is idle, idle() counts the ticks.
+    if(cpuid() == 0 && !mycpu()->idle){
       acquire(&tickslock);
       ticks++;
-      wakeup(&ticks);
+      timertick();
       release(&tickslock);
+#ifdef MLFQ
+      if(ticks % MLFQBOOST == 0)
+        mlfqboost();
+#endif
     }
       
     lapiceoi();
@@ -91,6 +97,14 @@ trap(struct trapframe *tf)
             cpuid(), tf->cs, tf->eip);
     lapiceoi();
     break;
+  case T_TLBFLUSH:
+    tlbshootintr();
+    lapiceoi();
+    break;
+  case T_WAKEUP:
+    // Just brings an idle CPU out of hlt.
+    lapiceoi();
+    break;
 
   
     // In user space, assume process misbehaved.
@@ -104,57 +118,102 @@ trap(struct trapframe *tf)
     //reference to cleared page. if page IS in file and below 15 page limit,
     //copy the file into a free slot in memory. finally if at 15 page limit,
     //exchange file page for a victim memory page. 
+     cpucount(CNT_FAULTS, 1);
      faultingAddress = PGROUNDDOWN(rcr2());
-     p = myproc();
+     p = myproc()->leader;  //Threads share their leader's address space and paging state.
+     lockvm(p);  //Another thread may be faulting or growing it.
+
+	if(faultingAddress >= p->sz)  //Not heap: a mapped file, or a bad address.
+	{
+		if(mmapfault(p, rcr2(), tf->err) != 0)  //Unlocks p.
+		{
+			cprintf("pid %d %s: page fault at 0x%x beyond sz--kill proc\n",
+			        myproc()->pid, myproc()->name, rcr2());
+			myproc()->killed = 1;
+		}
+		break;
+	}
    
 
 	if(p->pageCtTotal >= MAX_TOTAL_PAGES)
 	{
-		p->killed = 1;
+		unlockvm(p);
+		myproc()->killed = 1;
 		exit();
 	}
       
     char *mem = 0;
-	pte = walkpgdir(p->pgdir, (char *)faultingAddress, 0);
+    struct page *pg;  //The faulting page's record.
+    int swapped, i;
+
+	//Allocate the page table now, so mappages() below cannot fail.
+	if((pte = walkpgdir(p->pgdir, (char *)faultingAddress, 1)) == 0)
+	{
+		cprintf("lazyalloc out of memory\n");
+		unlockvm(p);
+		myproc()->killed = 1;
+		break;
+	}
+	swapped = *pte & PTE_PG;
 	
-    //mem = kalloc();
     //case 1: unallocated, <15 pages in memory: we know this is the case because 
     //there is no page struct with a matching address. response is to allocate
     //and return
-    if (!(*pte & PTE_PG))  //This page has not been swapped out, so we allocate it.
+    if (!swapped)  //This page has not been swapped out, so we allocate it.
     {
 		p->pageCtTotal++;
     }
+
+	//Find the page's record: its own if it is in the swap file, else an unused one.
+	pg = 0;
+	for(i = 0; i < MAX_TOTAL_PAGES; i++)
+	{
+		if(swapped ? (p->pages[i]->swapped == 1 && p->pages[i]->address == faultingAddress)
+		           : p->pages[i]->swapped < 0)
+		{
+			pg = p->pages[i];
+			break;
+		}
+	}
+	if(pg == 0)
+		panic("pagefault: no page record");
 	
     if (p->pageCtTotal - p->pageCtFile >= 15) //memory full so must swap with file
     {
         struct page *victim;
+
         cprintf("starting swapping");
 		
         //Select a victim using a page replacement algorithm.
         #ifdef FIFO    
-        victim = queue[0];  //Remove the first item in the queue.
+        victim = p->queue[0];  //Remove the first item in the queue.
+        p->size--;
         
         int index;
 		
-        for (index = 0; index < 14; index++)  //Shift the entire queue by one space to the left.
+        for (index = 0; index < p->size; index++)  //Shift the rest of the queue by one space to the left.
         {
-          queue[index] = queue[index+1];
+          p->queue[index] = p->queue[index+1];
         }
 		#endif
         #ifdef RAND  
         randstate = randstate * 1664525 + 1013904223;  
-        replaceindex = randstate % 15  //Generate a random number between 0 and 14.
-        victim = randpages[replaceindex];
+        replaceindex = randstate % p->size;  //Pick one of the pages in memory.
+        victim = p->randpages[replaceindex];
+        p->randpages[replaceindex] = p->randpages[--p->size];  //Fill its slot from the end.
 		#endif
         #ifdef LRU
         victim = p->tail->page;  //Remove the item on the bottom of the stack.
         p->tail->inuse = 0;  //Remove the node from the stack.
         p->tail = p->tail->previousNode;  //The new tail is the next item on the bottom of the stack.
-        p->tail->nextNode = 0;
+        if(p->tail)
+          p->tail->nextNode = 0;
+        else
+          p->head = 0;  //The stack is empty.
+        p->size--;
         #endif
         
-        swapOut(victim);  //Call writeToSwapFile(), sending the victim memory to file
+        swapOut(victim);  //Unmap the victim and call writeToSwapFile(), sending its memory to file
 
 		cprintf("Out of swapOut\n");
 
@@ -162,7 +221,8 @@ trap(struct trapframe *tf)
 
 		vpte = walkpgdir(p->pgdir, (char*) victim->address, 0);  //generate the address of victim pte
         
-        mappages(p->pgdir, (char*) faultingAddress, PGSIZE, P2V(PTE_ADDR(*victimAddress)), PTE_P|PTE_W|PTE_U);  //Map the faulting address to the physical address of the victim.
+        mem = P2V(PTE_ADDR(*vpte));  //Reuse the victim's frame for the faulting page.
+        *vpte = PTE_FLAGS(*vpte);  //Keep PTE_PG but drop the frame, so only one PTE reaches it.
     }
     else  //else allocate the space and map it bc mem not full
 	{
@@ -171,105 +231,70 @@ trap(struct trapframe *tf)
         if (mem == 0)
 		{
 			cprintf("lazyalloc out of memory\n");
-			return;//return if kalloc unsuccessful
+			if(!swapped)
+				p->pageCtTotal--;
+			unlockvm(p);
+			myproc()->killed = 1;
+			break;
 		}
 
-        mappages(p->pgdir, (char*)faultingAddress, PGSIZE, V2P(mem), PTE_W|PTE_U);
-		
-		cprintf("kallocing and mapping new page, VA: %x to tpe addr: %x\n", n, (uint)V2P(mem));
-		cprintf("\nkalloc and map done");
-        //now add a page struct for this page, and update the proc statistics.
-		  
-        //Add p->pages[i] to data structure.
-		#ifdef FIFO    
-        p->queue[p->size] = p->pages[i];  //Add p->pages[i] to the end of the queue.
-        p->size++;
-		#endif
-        #ifdef RAND
-        p->randpages[p->size] = p->pages[i];  //Add p->pages[i] to randpages[replaceindex].
-        p->size++;
-        #endif
-		#ifdef LRU
-        struct node *newNode;
-        newNode = p->stack[p->size];
-        newNode->nextNode = p->head;  //Add the new node to the top of the stack.
-        newNode->previousNode = 0;
-        newNode->page = p->pages[i];  //Add p->pages[i] to the new node.
-        newNode->inuse = 1;
-        p->head->previousNode = newNode;
-        p->head = newNode;  //Make the new node the head.
-        p->size++;
-        #endif
+		cpucount(CNT_VMALLOCS, 1);
+		cprintf("kallocing new page, VA: %x to tpe addr: %x\n", faultingAddress, (uint)V2P(mem));
 	}
 
-    if(!(*pte & PTE_PG))  //in this case no entry so set the frame's contents to zero.
+    if(!swapped)  //in this case no entry so set the frame's contents to zero.
     {
 		memset(mem, 0, PGSIZE);
-		
-		//now add a page struct for this newly allocated page, and update the proc statistics
-        int i = 0;
-        for(i = 0; i < MAX_TOTAL_PAGES; i++)//increment through array to find unused page struct
-        {
-			if(p->pages[i]->swapped == 0)//found one at index i
-			{
-				p->pages[i]->swapped = 0;
-				p->pages[i]->address = faultingAddress;
-				p->freeInFile[i] = 0;
-            
-				break;
-			}  
-        }  
+		pg->swapped = 0;
+		pg->address = faultingAddress;
+		pg->file_index = 0;
     }
 	else  //Otherwise, load the page from the swap file.
 	{
-		struct page *swap;
-	    int j = 0;
-
-		swap = 0;
-
-	    for(j = 0; j < 30; j++)
-	    {
-        	if(p->pages[j]->address == faultingAddress)
-			{
-          		    swap = p->pages[j];
-        		    break;
-			}
-      	}
-
-      	readFromSwapFile(p, mem, swap->file_index*4096,4096);
-		proc()->pageCtFile--;
+      	readFromSwapFile(p, mem, pg->file_index*PGSIZE, PGSIZE);
+		p->freeInFile[pg->file_index] = 0;
+		p->pageCtFile--;
+		cpucount(CNT_SWAPINS, 1);
 		
-		swap->file_index = 0;
-		swap->swapped = 0;
+		pg->file_index = 0;
+		pg->swapped = 0;
+	}
 
-        //Add swap to data structure.
-        #ifdef FIFO    
-        queue[14] = swap;  //Add swap to the end of the queue.
-		#endif
-        #ifdef RAND
-        randpages[replaceindex] = swap;  //Add swap to randpages[replaceindex].
-		#endif
-        #ifdef LRU
-        int index;
+    //Map the frame only once it holds the page, so no other thread sees it early.
+    mappages(p->pgdir, (char*)faultingAddress, PGSIZE, V2P(mem), PTE_W|PTE_U);
+
+    //Add pg to data structure.
+    #ifdef FIFO    
+    p->queue[p->size++] = pg;  //Add pg to the end of the queue.
+    #endif
+    #ifdef RAND
+    p->randpages[p->size++] = pg;
+    #endif
+    #ifdef LRU
+    struct node *newNode;
+    int index;
         
-        for (index = 0; index < 15; index++)  //Look for a node that is not in use.
-        {
-			if(p->stack[index]->inuse == 0)
-			{
-				break;
-			}
-        }
+    for (index = 0; index < 14; index++)  //Look for a node that is not in use.
+    {
+		if(p->stack[index]->inuse == 0)
+		{
+			break;
+		}
+    }
         
-        struct node *newNode;
-        newNode = p->stack[index];
-        newNode->nextNode = p->head;  //Add the new node to the top of the stack.
-        newNode->previousNode = 0;
-        newNode->page = swap;  //Add swap to the new node.
-        newNode->inuse = 1;
-        p->head->previousNode = newNode;
-        p->head = newNode;  //Make the new node the head.
-        #endif
-	}	
+    newNode = p->stack[index];
+    newNode->nextNode = p->head;  //Add the new node to the top of the stack.
+    newNode->previousNode = 0;
+    newNode->page = pg;  //Add pg to the new node.
+    newNode->inuse = 1;
+    if(p->head)
+      p->head->previousNode = newNode;
+    else
+      p->tail = newNode;  //The stack was empty.
+    p->head = newNode;  //Make the new node the head.
+    p->size++;
+    #endif
+    unlockvm(p);
   
     break;
     //this far means the page has been created, so pagefault indicates it is in file
@@ -296,14 +321,19 @@ trap(struct trapframe *tf)
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
     exit();
 
-  // Force process to give up CPU on clock tick.
+  // Force process to give up CPU on clock tick once its quantum
+  // is used up or a higher-priority process is waiting (proctick).
   // If interrupts were on while locks held, would need to check nlock.
   if(myproc() && myproc()->state == RUNNING &&
      tf->trapno == T_IRQ0+IRQ_TIMER)  {
 	  #ifdef LRU
-  struct proc* p = myproc();
+  struct proc* p = myproc()->leader;  //The LRU stack is shared by all threads.
+  struct tlbbatch tb;  //Cleared accessed bits, so the MMU sets them again.
   pte_t *pte;
   int i;
+  if(trylockvm(p)){  //Skip this tick if a fault holds the address space.
+  tb.pgdir = p->pgdir;
+  tb.n = 0;
   for(i = 0; i < 15; i++)
   {
     if (p->stack[i]->inuse)
@@ -341,12 +371,20 @@ trap(struct trapframe *tf)
         }
       }
       
-      *pte &= ~PTE_A; //reset PTE_A
+      if (*pte & PTE_A)
+      {
+        *pte &= ~PTE_A; //reset PTE_A
+        tlbinval(&tb, p->stack[i]->page->address);
+      }
       
     }
   }
+  tlbflush(&tb);
+  unlockvm(p);
+  }
   #endif
-yield();
+    if(proctick())
+      yield();
 }
 
   // Check if the process has been killed since we yielded
@@ -1,5 +1,8 @@
 struct stat;
 struct rtcdate;
+struct meminfo;
+struct schedinfo;
+struct lockstat;
 
 // system calls
 int fork(void);
@@ -23,6 +26,22 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int shmget(int, int);
+void* shmat(int);
+int shmdt(void*);
+void* mmap(int, int, int, int, int);
+int munmap(void*, int);
+int meminfo(struct meminfo*);
+int getlevel(int);
+int settickets(int);
+int clone(void(*)(void*), void*, void*);
+int join(void**);
+int futex_wait(volatile uint*, uint);
+int futex_wake(volatile uint*, int);
+int settimeslice(int);
+int setaffinity(int, uint);
+int schedinfo(struct schedinfo*);
+int lockstat(struct lockstat*, int);
 
 // ulib.c
 int stat(char*, struct stat*);
@@ -37,3 +56,26 @@ void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
 int atoi(const char*);
+
+// uthread.c
+struct tlock {
+  volatile uint locked;
+};
+void tlock_init(struct tlock*);
+void tlock_acquire(struct tlock*);
+void tlock_release(struct tlock*);
+int thread_create(void(*)(void*), void*);
+int thread_join(void);
+struct mutex {
+  volatile uint val;
+};
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+void mutex_unlock(struct mutex*);
+struct cond {
+  volatile uint seq;
+};
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
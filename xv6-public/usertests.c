@@ -7,6 +7,9 @@
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
+#include "meminfo.h"
+#include "lockstat.h"
+#include "schedinfo.h"
 
 char buf[8192];
 char name[3];
@@ -457,6 +460,639 @@ mem(void)
   }
 }
 
+// does a shared memory segment carry data between processes
+// without copies, and survive the writer's exit?
+void
+shmtest(void)
+{
+  char *a, *b;
+  int id, pid, i;
+
+  printf(1, "shm test\n");
+  if((id = shmget(1550, 2*4096)) < 0){
+    printf(1, "shmget failed\n");
+    exit();
+  }
+  if((a = shmat(id)) == (char*)-1){
+    printf(1, "shmat failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    // child inherited the attachment
+    for(i = 0; i < 2*4096; i++)
+      a[i] = i % 251;
+    exit();
+  }
+  wait();
+  for(i = 0; i < 2*4096; i++){
+    if(a[i] != i % 251){
+      printf(1, "shm wrong data at %d\n", i);
+      exit();
+    }
+  }
+  if(shmget(1550, 0) != id){
+    printf(1, "shmget by key failed\n");
+    exit();
+  }
+  if(shmat(id) != (char*)-1){
+    printf(1, "shmat attached twice\n");
+    exit();
+  }
+  if(shmdt(a) < 0){
+    printf(1, "shmdt failed\n");
+    exit();
+  }
+  if(shmdt(a) >= 0){
+    printf(1, "shmdt of detached segment succeeded\n");
+    exit();
+  }
+  // the segment went away with its last attachment
+  if((id = shmget(1550, 4096)) < 0 || (b = shmat(id)) == (char*)-1 || b[0] != 0){
+    printf(1, "shm segment not recreated\n");
+    exit();
+  }
+  shmdt(b);
+  printf(1, "shm ok\n");
+}
+
+// are mapped file pages filled on demand, written back only
+// for MAP_SHARED, and copied on write after fork for MAP_PRIVATE?
+void
+mmaptest(void)
+{
+  char *a;
+  int fd, i, n, pid;
+
+  printf(1, "mmap test\n");
+  unlink("mmapfile");
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "create mmapfile failed\n");
+    exit();
+  }
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = 'a' + i % 26;
+  if(write(fd, buf, sizeof(buf)) != sizeof(buf) || write(fd, buf, 100) != 100){
+    printf(1, "write mmapfile failed\n");
+    exit();
+  }
+  n = sizeof(buf) + 100;
+
+  a = mmap(fd, 0, n, PROT_READ|PROT_WRITE, MAP_PRIVATE);
+  if(a == (char*)-1){
+    printf(1, "mmap private failed\n");
+    exit();
+  }
+  for(i = 0; i < n; i++){
+    if(a[i] != 'a' + i % sizeof(buf) % 26){
+      printf(1, "mmap wrong data at %d\n", i);
+      exit();
+    }
+  }
+  if(a[n] != 0){
+    printf(1, "mmap past end of file not zero\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    a[0] = 'X';
+    exit();
+  }
+  wait();
+  if(a[0] != 'a'){
+    printf(1, "mmap private not copied on write\n");
+    exit();
+  }
+  a[1] = 'Y';
+  if(munmap(a, n) < 0){
+    printf(1, "munmap failed\n");
+    exit();
+  }
+
+  a = mmap(fd, 0, n, PROT_READ|PROT_WRITE, MAP_SHARED);
+  if(a == (char*)-1){
+    printf(1, "mmap shared failed\n");
+    exit();
+  }
+  if(a[1] != 'b'){
+    printf(1, "mmap private written back\n");
+    exit();
+  }
+  a[4096] = 'Z';
+  if(munmap(a, 4096) < 0 || munmap(a + 4096, n - 4096) < 0){
+    printf(1, "munmap in two parts failed\n");
+    exit();
+  }
+  close(fd);
+
+  fd = open("mmapfile", O_RDONLY);
+  if(read(fd, buf, sizeof(buf)) != sizeof(buf) || buf[4096] != 'Z'){
+    printf(1, "mmap shared not written back\n");
+    exit();
+  }
+  if(mmap(fd, 0, 4096, PROT_READ|PROT_WRITE, MAP_SHARED) != (char*)-1){
+    printf(1, "mmap shared writable of read-only fd succeeded\n");
+    exit();
+  }
+  close(fd);
+  unlink("mmapfile");
+  printf(1, "mmap ok\n");
+}
+
+// re-reads and overwrites must see the latest data,
+// and a deleted file's cached pages must not come back.
+void
+pcachetest(void)
+{
+  int fd, i, n;
+
+  printf(1, "page cache test\n");
+  unlink("pcfile");
+  fd = open("pcfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "create pcfile failed\n");
+    exit();
+  }
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = 'a' + i % 26;
+  if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf(1, "write pcfile failed\n");
+    exit();
+  }
+  close(fd);
+
+  for(n = 0; n < 2; n++){
+    fd = open("pcfile", O_RDONLY);
+    memset(buf, 0, sizeof(buf));
+    if(read(fd, buf, 100) != 100 || read(fd, buf+100, sizeof(buf)) != sizeof(buf)-100){
+      printf(1, "read pcfile failed\n");
+      exit();
+    }
+    close(fd);
+    for(i = 0; i < sizeof(buf); i++){
+      if(buf[i] != 'a' + i % 26){
+        printf(1, "pcfile wrong data at %d\n", i);
+        exit();
+      }
+    }
+  }
+
+  // Overwrite across the first page boundary.
+  fd = open("pcfile", O_RDWR);
+  read(fd, buf, 4000);
+  memset(buf, 'X', 200);
+  write(fd, buf, 200);
+  close(fd);
+  fd = open("pcfile", O_RDONLY);
+  read(fd, buf, sizeof(buf));
+  close(fd);
+  for(i = 3990; i < 4210; i++){
+    if(buf[i] != ((i >= 4000 && i < 4200) ? 'X' : 'a' + i % 26)){
+      printf(1, "pcfile overwrite wrong at %d\n", i);
+      exit();
+    }
+  }
+
+  unlink("pcfile");
+  fd = open("pcfile", O_CREATE|O_RDWR);
+  write(fd, "new", 3);
+  close(fd);
+  fd = open("pcfile", O_RDONLY);
+  memset(buf, 0, sizeof(buf));
+  if(read(fd, buf, sizeof(buf)) != 3 || strcmp(buf, "new") != 0){
+    printf(1, "pcfile stale after unlink\n");
+    exit();
+  }
+  close(fd);
+  unlink("pcfile");
+  printf(1, "page cache ok\n");
+}
+
+struct meminfo mi;
+
+// our own pages must show up as resident or swapped.
+void
+meminfotest(void)
+{
+  struct procmem *pm;
+  int rss, i;
+  char *a;
+
+  printf(1, "meminfo test\n");
+  if(meminfo(&mi) < 0 || mi.free <= 0 || mi.free > mi.total){
+    printf(1, "meminfo totals wrong\n");
+    exit();
+  }
+  rss = -1;
+  for(pm = mi.proc; pm < &mi.proc[mi.nproc]; pm++)
+    if(pm->pid == getpid())
+      rss = pm->rss;
+  if(rss <= 0){
+    printf(1, "meminfo: no rss for self\n");
+    exit();
+  }
+
+  a = sbrk(10*4096);
+  for(i = 0; i < 10; i++)
+    a[i*4096] = 1;
+  meminfo(&mi);
+  for(pm = mi.proc; pm < &mi.proc[mi.nproc]; pm++){
+    if(pm->pid == getpid() && pm->rss + pm->swapped < rss + 10){
+      printf(1, "meminfo: rss did not grow\n");
+      exit();
+    }
+  }
+  sbrk(-10*4096);
+  printf(1, "meminfo ok\n");
+}
+
+// a process that never gives up the CPU must
+// sink below the top scheduling level.
+void
+mlfqtest(void)
+{
+  int pid, i, level;
+
+  printf(1, "mlfq test\n");
+#ifndef MLFQ
+  printf(1, "mlfq test skipped: not the MLFQ scheduler\n");
+  return;
+#endif
+  if(getlevel(getpid()) < 0 || getlevel(-1) != -1){
+    printf(1, "getlevel failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0)
+    for(;;)
+      ;
+  level = 0;
+  for(i = 0; i < 50 && level == 0; i++){
+    sleep(1);
+    level = getlevel(pid);
+  }
+  kill(pid);
+  wait();
+  if(level <= 0){
+    printf(1, "mlfq: spinning process not demoted\n");
+    exit();
+  }
+  printf(1, "mlfq ok\n");
+}
+
+// a process with a long timeslice stays at the top level
+// under MLFQ for longer than one with the default slice.
+void
+timeslicetest(void)
+{
+#ifdef MLFQ
+  int pid, i, level;
+#endif
+
+  printf(1, "timeslice test\n");
+  if(settimeslice(0) != -1 || settimeslice(MAXSLICE+1) != -1){
+    printf(1, "settimeslice accepted a bad slice\n");
+    exit();
+  }
+#ifdef MLFQ
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    settimeslice(MAXSLICE);
+    for(;;)
+      ;
+  }
+  level = 0;
+  for(i = 0; i < 20 && level == 0; i++){
+    sleep(1);
+    level = getlevel(pid);
+  }
+  kill(pid);
+  wait();
+  if(level != 0){
+    printf(1, "timeslice: long-slice process demoted\n");
+    exit();
+  }
+#endif
+  printf(1, "timeslice ok\n");
+}
+
+// a process pinned to one CPU keeps running there,
+// and bad masks and pids are refused.
+void
+affinitytest(void)
+{
+  static struct schedinfo si;
+  struct procsched *ps;
+  int pid, cpu;
+
+  printf(1, "affinity test\n");
+  if(setaffinity(getpid(), 0) != -1 || setaffinity(-1, 1) != -1){
+    printf(1, "setaffinity accepted a bad mask or pid\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0)
+    for(;;)
+      ;
+  if(setaffinity(pid, 1) != 0 || setaffinity(getpid(), 1) != 0){
+    printf(1, "setaffinity failed\n");
+    exit();
+  }
+  // Both now share CPU 0; we must still get to run.
+  sleep(2);
+  cpu = -1;
+  if(schedinfo(&si) == 0)
+    for(ps = si.proc; ps < &si.proc[si.nproc]; ps++)
+      if(ps->pid == pid)
+        cpu = ps->cpu;
+  if(cpu != 0){
+    printf(1, "affinity: pinned child on cpu %d\n", cpu);
+    exit();
+  }
+  kill(pid);
+  wait();
+  setaffinity(getpid(), ~0);
+  printf(1, "affinity ok\n");
+}
+
+// sleepers must wake at their own deadlines,
+// including ones far enough out to cascade.
+void
+sleeptest(void)
+{
+  static int n[] = { 1, 5, 70, 20 };
+  int fds[2], i, pid, t0, t;
+  char c;
+
+  printf(1, "sleep test\n");
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  for(i = 0; i < sizeof(n)/sizeof(n[0]); i++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      t0 = uptime();
+      sleep(n[i]);
+      t = uptime() - t0;
+      if(t < n[i] || t > n[i] + 10){
+        printf(1, "sleep(%d) took %d ticks\n", n[i], t);
+        write(fds[1], "x", 1);
+      }
+      exit();
+    }
+  }
+  close(fds[1]);
+  for(i = 0; i < sizeof(n)/sizeof(n[0]); i++)
+    wait();
+  if(read(fds[0], &c, 1) != 0){
+    printf(1, "sleep test failed\n");
+    exit();
+  }
+  close(fds[0]);
+  printf(1, "sleep ok\n");
+}
+
+#define NTHREAD 4
+
+struct tlock tcountlock;
+int tcount;
+
+void
+threadworker(void *arg)
+{
+  char *p;
+  int i;
+
+  for(i = 0; i < 1000; i++){
+    tlock_acquire(&tcountlock);
+    tcount += (int)arg;
+    tlock_release(&tcountlock);
+  }
+  // Grow the shared heap while the others do too.
+  p = sbrk(4096);
+  if(p == (char*)-1){
+    printf(1, "thread sbrk failed\n");
+    exit();
+  }
+  p[0] = p[4095] = 1;
+  exit();
+}
+
+// threads share memory, can grow it concurrently,
+// and are reaped by join, not wait.
+void
+threadtest(void)
+{
+  int i;
+
+  printf(1, "thread test\n");
+  tlock_init(&tcountlock);
+  tcount = 0;
+  for(i = 0; i < NTHREAD; i++){
+    if(thread_create(threadworker, (void*)1) < 0){
+      printf(1, "thread_create failed\n");
+      exit();
+    }
+  }
+  if(wait() != -1){
+    printf(1, "wait reaped a thread\n");
+    exit();
+  }
+  for(i = 0; i < NTHREAD; i++){
+    if(thread_join() < 0){
+      printf(1, "thread_join failed\n");
+      exit();
+    }
+  }
+  if(thread_join() != -1){
+    printf(1, "thread_join with no threads\n");
+    exit();
+  }
+  if(tcount != NTHREAD*1000){
+    printf(1, "threads counted %d\n", tcount);
+    exit();
+  }
+  printf(1, "thread ok\n");
+}
+
+struct mutex fmutex;
+struct cond fcond;
+int fcount, fready;
+
+void
+futexworker(void *arg)
+{
+  int i;
+
+  mutex_lock(&fmutex);
+  while(!fready)
+    cond_wait(&fcond, &fmutex);
+  mutex_unlock(&fmutex);
+  for(i = 0; i < 1000; i++){
+    mutex_lock(&fmutex);
+    fcount++;
+    mutex_unlock(&fmutex);
+  }
+  exit();
+}
+
+// futex-based mutexes and condition variables.
+void
+futextest(void)
+{
+  uint word;
+  int i;
+
+  printf(1, "futex test\n");
+  word = 1;
+  if(futex_wait(&word, 0) != -1 || futex_wake(&word, 1) != 0){
+    printf(1, "futex on a changed word\n");
+    exit();
+  }
+  mutex_init(&fmutex);
+  cond_init(&fcond);
+  fcount = fready = 0;
+  for(i = 0; i < NTHREAD; i++){
+    if(thread_create(futexworker, 0) < 0){
+      printf(1, "thread_create failed\n");
+      exit();
+    }
+  }
+  sleep(2);
+  mutex_lock(&fmutex);
+  fready = 1;
+  cond_broadcast(&fcond);
+  mutex_unlock(&fmutex);
+  for(i = 0; i < NTHREAD; i++)
+    thread_join();
+  if(fcount != NTHREAD*1000){
+    printf(1, "futex mutex counted %d\n", fcount);
+    exit();
+  }
+  printf(1, "futex ok\n");
+}
+
+// pipe locks are counted, and a reset zeroes the counts.
+void
+lockstattest(void)
+{
+  static struct lockstat ls;
+  struct lockinfo *li;
+  int fds[2], found;
+  char c;
+
+  printf(1, "lockstat test\n");
+  if(pipe(fds) < 0){
+    printf(1, "pipe failed\n");
+    exit();
+  }
+  write(fds[1], "x", 1);
+  read(fds[0], &c, 1);
+  close(fds[0]);
+  close(fds[1]);
+  if(lockstat(&ls, 1) < 0){
+    printf(1, "lockstat failed\n");
+    exit();
+  }
+  found = 0;
+  for(li = ls.lock; li < &ls.lock[ls.n]; li++)
+    if(strcmp(li->name, "pipe") == 0 && !li->sleep)
+      found = li->nacquire;
+  if(found == 0){
+    printf(1, "lockstat: pipe lock not counted\n");
+    exit();
+  }
+  lockstat(&ls, 0);
+  for(li = ls.lock; li < &ls.lock[ls.n]; li++)
+    if(strcmp(li->name, "pipe") == 0 && !li->sleep && li->nacquire != 0){
+      printf(1, "lockstat: reset failed\n");
+      exit();
+    }
+  printf(1, "lockstat ok\n");
+}
+
+// readers of one file share its inode lock while a writer
+// flips it between two patterns; no read sees a mix of both.
+void
+sharedreadtest(void)
+{
+  char data[2][512], got[512];
+  int fd, i, j, k, p, pid;
+
+  printf(1, "shared read test\n");
+  for(i = 0; i < sizeof(got); i++){
+    data[0][i] = 'a' + i % 26;
+    data[1][i] = 'A' + i % 26;
+  }
+  unlink("srfile");
+  fd = open("srfile", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, data[0], sizeof(got)) != sizeof(got)){
+    printf(1, "create srfile failed\n");
+    exit();
+  }
+  close(fd);
+
+  for(k = 0; k < 4; k++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      for(i = 0; i < 50; i++){
+        fd = open("srfile", O_RDONLY);
+        if(fd < 0 || read(fd, got, sizeof(got)) != sizeof(got)){
+          printf(1, "read srfile failed\n");
+          exit();
+        }
+        close(fd);
+        p = got[0] != data[0][0];
+        for(j = 0; j < sizeof(got); j++)
+          if(got[j] != data[p][j]){
+            printf(1, "srfile torn read at %d\n", j);
+            exit();
+          }
+      }
+      exit();
+    }
+  }
+  for(i = 0; i < 40; i++){
+    fd = open("srfile", O_RDWR);
+    write(fd, data[i % 2], sizeof(got));
+    close(fd);
+  }
+  for(k = 0; k < 4; k++)
+    wait();
+  unlink("srfile");
+  printf(1, "shared read ok\n");
+}
+
 // More file system tests
 
 // two processes write to the same file descriptor
@@ -1780,6 +2416,18 @@ main(int argc, char *argv[])
   iputtest();
 
   mem();
+  shmtest();
+  mmaptest();
+  pcachetest();
+  meminfotest();
+  mlfqtest();
+  timeslicetest();
+  affinitytest();
+  sleeptest();
+  threadtest();
+  futextest();
+  lockstattest();
+  sharedreadtest();
   pipe1();
   preempt();
   exitwait();
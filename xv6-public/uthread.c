@@ -0,0 +1,144 @@
+// User-level thread library over clone() and join().
+//
+// Each thread gets a one-page stack from malloc, which is not
+// itself thread-safe, so creating and joining threads are
+// serialized by threadlock.
+//
+// tlocks spin; mutexes and condition variables sleep in the
+// kernel with futex_wait() and cost no system call when there
+// is no contention.
+
+#include "types.h"
+#include "param.h"
+#include "user.h"
+#include "x86.h"
+
+#define TSTACKSIZE 4096
+
+static struct tlock threadlock;
+
+void
+tlock_init(struct tlock *lk)
+{
+  lk->locked = 0;
+}
+
+void
+tlock_acquire(struct tlock *lk)
+{
+  while(xchg(&lk->locked, 1) != 0)
+    ;
+}
+
+void
+tlock_release(struct tlock *lk)
+{
+  xchg(&lk->locked, 0);
+}
+
+// Start a thread running fn(arg); fn must call exit().
+// Returns the thread's pid, or -1.
+int
+thread_create(void (*fn)(void*), void *arg)
+{
+  void *stack;
+  int pid;
+
+  tlock_acquire(&threadlock);
+  stack = malloc(TSTACKSIZE);
+  tlock_release(&threadlock);
+  if(stack == 0)
+    return -1;
+  if((pid = clone(fn, arg, stack)) < 0){
+    tlock_acquire(&threadlock);
+    free(stack);
+    tlock_release(&threadlock);
+  }
+  return pid;
+}
+
+// Wait for some thread to exit and free its stack.
+// Returns its pid, or -1 if there are no threads.
+int
+thread_join(void)
+{
+  void *stack;
+  int pid;
+
+  if((pid = join(&stack)) < 0)
+    return -1;
+  tlock_acquire(&threadlock);
+  free(stack);
+  tlock_release(&threadlock);
+  return pid;
+}
+
+// Mutex states.
+#define UNLOCKED  0
+#define LOCKED    1   // Locked, no sleepers
+#define CONTENDED 2   // Locked, and there may be sleepers
+
+void
+mutex_init(struct mutex *m)
+{
+  m->val = UNLOCKED;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+  uint c;
+
+  if((c = __sync_val_compare_and_swap(&m->val, UNLOCKED, LOCKED)) == UNLOCKED)
+    return;
+  // Mark it contended so the holder wakes us, then sleep
+  // until we are the one that finds it unlocked.
+  if(c != CONTENDED)
+    c = xchg(&m->val, CONTENDED);
+  while(c != UNLOCKED){
+    futex_wait(&m->val, CONTENDED);
+    c = xchg(&m->val, CONTENDED);
+  }
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__sync_fetch_and_sub(&m->val, 1) != LOCKED){
+    m->val = UNLOCKED;
+    futex_wake(&m->val, 1);
+  }
+}
+
+void
+cond_init(struct cond *c)
+{
+  c->seq = 0;
+}
+
+// Release m, wait for a signal, and lock m again.
+// Like any condition variable, it may wake early.
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  uint seq;
+
+  seq = c->seq;
+  mutex_unlock(m);
+  futex_wait(&c->seq, seq);
+  mutex_lock(m);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, NPROC);
+}
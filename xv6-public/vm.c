@@ -6,27 +6,40 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "traps.h"
+#include "meminfo.h"
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
 
-// Set up CPU's kernel segment descriptors.
+// Set up CPU's kernel segment descriptors, and point %gs
+// at its struct cpu for mycpu() and myproc().
 // Run once on entry on each CPU.
 void
 seginit(void)
 {
   struct cpu *c;
+  int apicid;
 
   // Map "logical" addresses to virtual addresses using identity map.
   // Cannot share a CODE descriptor for both kernel and user
   // because it would have to have DPL_USR, but the CPU forbids
   // an interrupt from CPL=0 to DPL=3.
-  c = &cpus[cpuid()];
+  // APIC IDs are not guaranteed to be contiguous.
+  apicid = lapicid();
+  for(c = cpus; c < &cpus[ncpu]; c++)
+    if(c->apicid == apicid)
+      break;
+  if(c == &cpus[ncpu])
+    panic("seginit: unknown apicid");
   c->gdt[SEG_KCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, 0);
   c->gdt[SEG_KDATA] = SEG(STA_W, 0, 0xffffffff, 0);
   c->gdt[SEG_UCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, DPL_USER);
   c->gdt[SEG_UDATA] = SEG(STA_W, 0, 0xffffffff, DPL_USER);
+  c->gdt[SEG_KCPU] = SEG(STA_W, c, sizeof(*c)-1, 0);
+  c->self = c;
   lgdt(c->gdt, sizeof(c->gdt));
+  loadgs(SEG_KCPU << 3);
 }
 
 // Return the address of the PTE in page table pgdir
@@ -79,6 +92,43 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
   return 0;
 }
 
+// Start a walk over the PTEs for [start, end) in pgdir.
+// start must be page-aligned.
+void
+ptwalkinit(struct ptwalk *w, pde_t *pgdir, uint start, uint end)
+{
+  w->pgdir = pgdir;
+  w->va = start;
+  w->end = end;
+  w->pte = 0;
+  w->n = 0;
+}
+
+// Advance to the next page table that maps part of the range,
+// skipping absent page tables in one step.  On return w->pte[0..n)
+// are the PTEs for w->base, w->base+PGSIZE, ... within that table.
+// Returns 0 once the whole range has been visited.
+int
+ptwalknext(struct ptwalk *w)
+{
+  uint next;
+
+  while(w->va < w->end){
+    next = PGADDR(PDX(w->va) + 1, 0, 0);
+    if(next == 0 || next > w->end)
+      next = w->end;
+    if(w->pgdir[PDX(w->va)] & PTE_P){
+      w->base = w->va;
+      w->pte = (pte_t*)P2V(PTE_ADDR(w->pgdir[PDX(w->va)])) + PTX(w->va);
+      w->n = (PGROUNDUP(next) - w->va) / PGSIZE;
+      w->va = next;
+      return 1;
+    }
+    w->va = next;
+  }
+  return 0;
+}
+
 // There is one page table per process, plus one that's used when
 // a CPU is not running any process (kpgdir). The kernel uses the
 // current process's page table during system calls and interrupts;
@@ -141,15 +191,17 @@ void
 kvmalloc(void)
 {
   kpgdir = setupkvm();
-  switchkvm();
+  lcr3(V2P(kpgdir));   // cpus[] is not set up yet, so no switchkvm()
 }
 
 // Switch h/w page table register to the kernel-only page table,
 // for when no process is running.
+// Must be called with interrupts disabled.
 void
 switchkvm(void)
 {
   lcr3(V2P(kpgdir));   // switch to the kernel page table
+  mycpu()->pgdir = kpgdir;
 }
 
 // Switch TSS and h/w page table to correspond to process p.
@@ -173,6 +225,10 @@ switchuvm(struct proc *p)
   // forbids I/O instructions (e.g., inb and outb) from user space
   mycpu()->ts.iomb = (ushort) 0xFFFF;
   ltr(SEG_TSS << 3);
+  // Publish the new page table before loading it, so that a
+  // concurrent tlbflush() cannot miss this CPU.
+  mycpu()->pgdir = p->pgdir;
+  __sync_synchronize();
   lcr3(V2P(p->pgdir));  // switch to process's address space
   popcli();
 }
@@ -189,6 +245,7 @@ inituvm(pde_t *pgdir, char *init, uint sz)
   mem = kalloc();
   memset(mem, 0, PGSIZE);
   mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W|PTE_U);
+  cpucount(CNT_VMALLOCS, 1);
   memmove(mem, init, sz);
 }
 
@@ -224,7 +281,7 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   char *mem;
   uint a;
 
-  if(newsz >= KERNBASE)
+  if(newsz >= MMAPBASE)
     return 0;
   if(newsz < oldsz)
     return oldsz;
@@ -244,37 +301,62 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
       kfree(mem);
       return 0;
     }
+    cpucount(CNT_VMALLOCS, 1);
   }
   return newsz;
 }
 
+// Free the user pages in [PGROUNDUP(newsz), oldsz) and clear
+// their PTEs.  If tb is non-zero, queue each cleared address
+// for TLB invalidation.
+static void
+unmapuvm(pde_t *pgdir, uint oldsz, uint newsz, struct tlbbatch *tb)
+{
+  struct ptwalk w;
+  pte_t *pte;
+  uint pa;
+  int i;
+
+  ptwalkinit(&w, pgdir, PGROUNDUP(newsz), oldsz);
+  while(ptwalknext(&w)){
+    for(i = 0; i < w.n; i++){
+      pte = &w.pte[i];
+      if((*pte & PTE_P) == 0){
+        // A paged-out page's frame now belongs to another page;
+        // its swap slot is freed by pagedrop().
+        if(*pte & PTE_PG)
+          *pte = 0;
+        continue;
+      }
+      pa = PTE_ADDR(*pte);
+      if(pa == 0)
+        panic("kfree");
+      kfree(P2V(pa));
+      cpucount(CNT_VMFREES, 1);
+      *pte = 0;
+      if(tb)
+        tlbinval(tb, w.base + i*PGSIZE);
+    }
+  }
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
 // process size.  Returns the new process size.
+// Must not be called with a spinlock held (see tlbflush).
 int
 deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
-  pte_t *pte;
-  uint a, pa;
+  struct tlbbatch tb;
 
   if(newsz >= oldsz)
     return oldsz;
 
-  a = PGROUNDUP(newsz);
-  for(; a  < oldsz; a += PGSIZE){
-    pte = walkpgdir(pgdir, (char*)a, 0);
-    if(!pte)
-      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
-    else if((*pte & PTE_P) != 0){
-      pa = PTE_ADDR(*pte);
-      if(pa == 0)
-        panic("kfree");
-      char *v = P2V(pa);
-      kfree(v);
-      *pte = 0;
-    }
-  }
+  tb.pgdir = pgdir;
+  tb.n = 0;
+  unmapuvm(pgdir, oldsz, newsz, &tb);
+  tlbflush(&tb);
   return newsz;
 }
 
@@ -287,7 +369,9 @@ freevm(pde_t *pgdir)
 
   if(pgdir == 0)
     panic("freevm: no pgdir");
-  deallocuvm(pgdir, KERNBASE, 0);
+  // No CPU has pgdir loaded any more, so there is nothing
+  // to invalidate.
+  unmapuvm(pgdir, KERNBASE, 0, 0);
   for(i = 0; i < NPDENTRIES; i++){
     if(pgdir[i] & PTE_P){
       char * v = P2V(PTE_ADDR(pgdir[i]));
@@ -311,29 +395,47 @@ clearpteu(pde_t *pgdir, char *uva)
 }
 
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child.  Pages that were never touched (not
+// yet allocated by the fault handler) are left unmapped,
+// and paged-out ones stay paged out; fork() copies their
+// swap slots.
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
-  pte_t *pte;
-  uint pa, i, flags;
+  pte_t *pte, *dpte;
+  struct ptwalk w;
+  uint pa, flags;
   char *mem;
+  int i;
 
   if((d = setupkvm()) == 0)
     return 0;
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
-    pa = PTE_ADDR(*pte);
-    flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0)
-      goto bad;
+  ptwalkinit(&w, pgdir, 0, sz);
+  while(ptwalknext(&w)){
+    dpte = 0;
+    for(i = 0; i < w.n; i++){
+      pte = &w.pte[i];
+      if(*pte == 0)
+        continue;
+      if(!(*pte & (PTE_P|PTE_PG)))
+        panic("copyuvm: page not present");
+      // The child's page table covers the same range as w.pte.
+      if(dpte == 0 && (dpte = walkpgdir(d, (void*)w.base, 1)) == 0)
+        goto bad;
+      if(!(*pte & PTE_P)){
+        // Its frame is someone else's now; keep just the flags.
+        dpte[i] = PTE_FLAGS(*pte);
+        continue;
+      }
+      pa = PTE_ADDR(*pte);
+      flags = PTE_FLAGS(*pte);
+      if((mem = kalloc()) == 0)
+        goto bad;
+      memmove(mem, (char*)P2V(pa), PGSIZE);
+      dpte[i] = V2P(mem) | flags;
+      cpucount(CNT_VMALLOCS, 1);
+    }
   }
   return d;
 
@@ -342,6 +444,106 @@ bad:
   return 0;
 }
 
+//PAGEBREAK!
+// TLB shootdown.
+//
+// Code that clears or changes a present PTE queues the virtual
+// address with tlbinval() and calls tlbflush() once it has made
+// all of its changes.  tlbflush() drops the stale entries from
+// this CPU's TLB with invlpg, and sends a T_TLBFLUSH IPI to every
+// other CPU that has the same page table loaded, waiting until
+// each has done the same.  Switching %cr3 flushes everything, so
+// CPUs running other page tables are left alone.
+//
+// Only one shootdown is in flight at a time.  A CPU waiting for
+// its turn keeps answering the current one, so two CPUs flushing
+// at once cannot deadlock; the caller must not hold a spinlock,
+// since the target CPUs may be spinning on it with interrupts off.
+struct {
+  volatile uint busy;     // a shootdown is in progress
+  volatile uint pending;  // bitmask of CPUs that have yet to flush
+  pde_t *pgdir;
+  int n;
+  uint va[NTLBBATCH];
+} shootdown;
+
+// Queue va for invalidation in tb's page table.
+void
+tlbinval(struct tlbbatch *tb, uint va)
+{
+  if(tb->n == NTLBBATCH)
+    tlbflush(tb);
+  tb->va[tb->n++] = PGROUNDDOWN(va);
+}
+
+// Flush this CPU's part of the current shootdown, if any.
+// Must be called with interrupts disabled.
+static void
+tlbshootlocal(void)
+{
+  uint bit;
+  int i;
+
+  bit = 1 << cpuid();
+  if((shootdown.pending & bit) == 0)
+    return;
+  if(mycpu()->pgdir == shootdown.pgdir)
+    for(i = 0; i < shootdown.n; i++)
+      invlpg((void*)shootdown.va[i]);
+  __sync_fetch_and_and(&shootdown.pending, ~bit);
+}
+
+// T_TLBFLUSH interrupt handler.
+void
+tlbshootintr(void)
+{
+  tlbshootlocal();
+}
+
+// Invalidate the addresses queued in tb on every CPU that
+// may have them cached, then empty tb.
+void
+tlbflush(struct tlbbatch *tb)
+{
+  struct cpu *c;
+  uint mask;
+  int i;
+
+  if(tb->n == 0)
+    return;
+
+  pushcli();
+  if(mycpu()->pgdir == tb->pgdir)
+    for(i = 0; i < tb->n; i++)
+      invlpg((void*)tb->va[i]);
+
+  // The PTE updates must be visible before we look at which
+  // page tables the other CPUs have loaded (see switchuvm).
+  __sync_synchronize();
+  mask = 0;
+  for(c = cpus; c < cpus+ncpu; c++)
+    if(c != mycpu() && c->pgdir == tb->pgdir)
+      mask |= 1 << (c - cpus);
+
+  if(mask){
+    while(xchg(&shootdown.busy, 1) != 0)
+      tlbshootlocal();
+    shootdown.pgdir = tb->pgdir;
+    shootdown.n = tb->n;
+    memmove(shootdown.va, tb->va, tb->n * sizeof(tb->va[0]));
+    __sync_synchronize();
+    shootdown.pending = mask;
+    for(c = cpus; c < cpus+ncpu; c++)
+      if(mask & (1 << (c - cpus)))
+        lapicipi(c->apicid, T_TLBFLUSH);
+    while(shootdown.pending)
+      ;
+    xchg(&shootdown.busy, 0);
+  }
+  popcli();
+  tb->n = 0;
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
@@ -383,6 +585,32 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
   return 0;
 }
 
+// Number of pages present in the user part of pgdir.
+int
+residentpages(pde_t *pgdir)
+{
+  struct ptwalk w;
+  int i, n;
+
+  n = 0;
+  ptwalkinit(&w, pgdir, 0, KERNBASE);
+  while(ptwalknext(&w))
+    for(i = 0; i < w.n; i++)
+      if(w.pte[i] & PTE_P)
+        n++;
+  return n;
+}
+
+// Fill in the paging event counts of m.
+void
+vmmeminfo(struct meminfo *m)
+{
+  m->allocs = cpucounts(CNT_VMALLOCS);
+  m->frees = cpucounts(CNT_VMFREES);
+  m->swapins = cpucounts(CNT_SWAPINS);
+  m->swapouts = cpucounts(CNT_SWAPOUTS);
+}
+
 //PAGEBREAK!
 // Blank page.
 //PAGEBREAK!